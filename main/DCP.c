@@ -1,4 +1,5 @@
 #include "DCP.h"
+#include "DCP_internal.h"
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -9,11 +10,14 @@
 #include <driver/gpio.h>
 #include <esp_private/esp_clk.h>
 #include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
 #include <rom/ets_sys.h>
 #include "esp_cpu.h"
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -21,22 +25,57 @@ static char* TAG = "DCP Driver";
 #define DEBUG_PIN 8
 
 portMUX_TYPE criticalMutex = portMUX_INITIALIZER_UNLOCKED;
-volatile DCP_MODE busMode;
 
-QueueHandle_t RXmessageQueue = NULL;
-QueueHandle_t TXmessageQueue = NULL;
-RingbufHandle_t isrBuf = NULL;
-
-TaskHandle_t busTask = NULL;
-
-static const float deltaLUT[] = {20, 4, 2.5, 1.25};
-volatile struct {
-    float delta;    //transmission time unit
-    float moe;      //transmission margin of error
-    esp_cpu_cycle_count_t limits[2];
-} configParam;
-
-static double CLOCK_TO_TIME;
+//item of TXmessageQueue
+struct DCP_TXItem_t {
+    uint8_t* data;
+    struct DCP_TXStatus_t* status;
+    uint8_t retries;
+    bool late;              //send it after the deadline anyway
+    bool hasDeadline;
+    TickType_t deadline;
+
+    DCP_TXCallback_t onDone;
+    void* ctx;
+    TaskHandle_t notify;
+
+    //the cycle counter is reset by every Delay, so these are in us
+    int64_t enqueued;
+    int64_t wire;           //last sync put on the bus
+};
+
+//status handles of SendMessageAsync, shared by every bus
+static struct {
+    struct DCP_TXStatus_t status;
+    bool used;
+} statusPool[CONFIG_DCP_TX_HANDLES];
+
+//everything a bus needs, one per DCPInit
+struct DCP_Handle {
+    gpio_num_t pin;
+    volatile DCP_MODE busMode;
+    struct DCP_Timing_t configParam;
+
+    QueueHandle_t RXmessageQueue;
+    QueueHandle_t TXmessageQueue[TX_PRIORITY_COUNT];
+    RingbufHandle_t isrBuf;
+    TaskHandle_t busTask;
+    volatile bool stopping;     //set by DCPDeinit, the task finishes its message and leaves
+
+    struct DCP_RetryPolicy_t retryPolicy;
+    bool filtering;
+
+    DCP_RXCallback_t rxCallback;
+    void* rxContext;
+
+    uint8_t rxFrame[0xFF];      //frame being read by the ISR
+};
+
+static const struct DCP_RetryPolicy_t defaultPolicy = {
+    .maxRetries = CONFIG_DCP_TX_MAX_RETRIES,
+    .window = CONFIG_DCP_TX_BACKOFF_WINDOW,
+    .agingStep = CONFIG_DCP_TX_AGING_STEP
+};
 
 /*!
  * @brief generic definition of function that delays for microsseconds
@@ -54,36 +93,51 @@ static __attribute__((always_inline)) inline void Delay(const esp_cpu_cycle_coun
     taskEXIT_CRITICAL(&criticalMutex);
 }
 
-bool s_ReadBit(const gpio_num_t pin){
+bool s_ReadBit(const gpio_num_t pin, const esp_cpu_cycle_count_t limit){
     
     while (gpio_get_level(pin) == 0)
         continue;
 
     //reading high time
     esp_cpu_set_cycle_count(0);
-    for (esp_cpu_cycle_count_t lim = configParam.limits[1] << 1; gpio_get_level(pin) == 1 && esp_cpu_get_cycle_count() < lim;)
+    for (esp_cpu_cycle_count_t lim = limit << 1; gpio_get_level(pin) == 1 && esp_cpu_get_cycle_count() < lim;)
         continue;
 
-    return esp_cpu_get_cycle_count() <= configParam.limits[1]? 0: 1;
+    return esp_cpu_get_cycle_count() <= limit? 0: 1;
 }
 
-uint8_t s_ReadByte(const gpio_num_t pin){
+uint8_t s_ReadByte(const gpio_num_t pin, const esp_cpu_cycle_count_t limit){
 
     uint8_t byte = 0;
 
     for (int i = 7; i >= 0; --i){
-        byte |= s_ReadBit(pin) << i;
+        byte |= s_ReadBit(pin, limit) << i;
     }
 
     return byte;
 }
 
+static bool s_Accepted(const DCP_Handle* bus, const uint8_t addr){
+    if (addr == DCP_BROADCAST && bus->busMode.broadcast) return true;
+
+    return (bus->busMode.accept[addr >> 5] >> (addr & 0x1F)) & 0x1;
+}
+
+//skips the rest of a frame for someone else, it is over once the line stays high longer than a bit 1
+static void s_SkipFrame(const gpio_num_t pin, const esp_cpu_cycle_count_t limit){
+    for (esp_cpu_set_cycle_count(0); esp_cpu_get_cycle_count() < 3*limit;){
+        if (gpio_get_level(pin) == 0) esp_cpu_set_cycle_count(0);
+    }
+}
+
 static void BusISR(void* arg){
-    const gpio_num_t pin = (gpio_num_t)arg;
+    DCP_Handle* const bus = arg;
+    const gpio_num_t pin = bus->pin;
+    const esp_cpu_cycle_count_t limit = bus->configParam.limits[1];
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-    static uint8_t data[0xFF];
+    uint8_t* const data = bus->rxFrame;
 
-    vTaskNotifyGiveFromISR(busTask, &xHigherPriorityTaskWoken);
+    vTaskNotifyGiveFromISR(bus->busTask, &xHigherPriorityTaskWoken);
 
     //reading incoming data
     gpio_set_direction(pin, GPIO_MODE_INPUT);
@@ -94,29 +148,38 @@ static void BusISR(void* arg){
 
     gpio_set_level(2, 1);
     for (esp_cpu_set_cycle_count(0); gpio_get_level(pin) == 1; ){
-        if(esp_cpu_get_cycle_count() > 10*configParam.limits[1]){
+        if(esp_cpu_get_cycle_count() > 10*limit){
             portYIELD_FROM_ISR( xHigherPriorityTaskWoken );
             return;
         }
     }
 
-    if(esp_cpu_get_cycle_count() <= 6*configParam.limits[0]){
+    if(esp_cpu_get_cycle_count() <= 6*bus->configParam.limits[0]){
         portYIELD_FROM_ISR( xHigherPriorityTaskWoken );
         return;
     }
 
     gpio_set_level(2, 0);
 
-    data[0] = s_ReadByte(pin);
+    data[0] = s_ReadByte(pin, limit);
     const uint8_t flag = data[0]? data[0]: sizeof(struct DCP_Message_L3_t)+1;
 
+    //destination byte, IDD for L3 and the address of generic frames
+    const uint8_t destination = data[0]? offsetof(struct DCP_Message_t, generic.addr): offsetof(struct DCP_Message_t, L3.IDD);
+
     for (int i = 1; i < flag; ++i){
         gpio_set_level(2, 1);
-        data[i] = s_ReadByte(pin);
+        data[i] = s_ReadByte(pin, limit);
         gpio_set_level(2, 0);
+
+        if (i == destination && bus->filtering && !s_Accepted(bus, data[i])){
+            s_SkipFrame(pin, limit);
+            portYIELD_FROM_ISR( xHigherPriorityTaskWoken );
+            return;
+        }
     }
 
-    (void)xRingbufferSendFromISR(isrBuf, data, flag, 0);
+    (void)xRingbufferSendFromISR(bus->isrBuf, data, flag, 0);
     gpio_set_level(2, 1);
 
     portYIELD_FROM_ISR( xHigherPriorityTaskWoken );
@@ -163,63 +226,219 @@ bool s_SendBytes(gpio_num_t const pin, uint8_t const size, uint8_t const data[si
     return false;
 }
 
+//TODO change this BS
+#ifdef CONFIG_IDF_TARGET_ESP32C3
+
+//negative skews in us to be added to the timings
+static const unsigned int skews[4][5] = {
+    //listening, sync, bitsync, 0, 1
+    {0, 20, 0, 4, 4},
+    {0, 25, 0, 2, 1},
+    {0, 20, 0, 2, 2},
+    {0, 20, 0, 1, 0}
+};
+
+#else 
+
+static const unsigned int skews[4][5] = {
+    {0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0}
+};
+
+#endif
+
+//cycles of a width on the wire without the software overhead of sending it, 0 if it is shorter than that
+static uint32_t s_Cycles(const float width, const unsigned skew, const uint32_t freqMHz, bool* exact){
+
+    if (width < skew){
+        *exact = false;
+        return 0;
+    }
+
+    return (width - skew)*freqMHz;
+}
+
+/*!
+ * @brief cycles of each part of a frame at a speed, with the skews of the target
+ * @param scales = stretch of the sync, bit sync, bit 0 and bit 1 widths on the wire, NULL for the nominal ones
+ * @param delays = sync, each half of the bit sync, bit 0 high, bit 1 high
+ * @return false if a scaled width is shorter than the time it takes to send it, its delay is then 0
+ */
+bool DCPFrameDelays(const enum DCP_Speed_e speed, const bool isController, const float scales[4], uint32_t delays[4]){
+    static const float nominal[4] = {1, 1, 1, 1};
+
+    const uint32_t freqMHz = esp_clk_cpu_freq()/1e6;
+    const float delta = DCPSpeedTiming(speed)->delta;
+    const float* const k = scales? scales: nominal;
+    bool exact = true;
+
+    delays[0] = s_Cycles((isController?25:50) * delta*k[0], skews[speed][1], freqMHz, &exact);
+    delays[2] = s_Cycles(delta*k[2], skews[speed][3], freqMHz, &exact);
+    delays[3] = s_Cycles(2*delta*k[3], skews[speed][4], freqMHz, &exact);
+
+    //the bus task has always sent 8 bit 0 highs for each half
+    delays[1] = s_Cycles(8*delta*k[1], 8*skews[speed][3], freqMHz, &exact);
+
+    return exact;
+}
+
+/*!
+ * @brief sends a whole frame, without the priority delay of the bus task
+ * @param delays = as given by DCPFrameDelays
+ * @return true on collision, or if the bus was already taken
+ */
+bool DCPSendFrame(gpio_num_t const pin, uint32_t const delays[restrict 4], uint8_t const size, uint8_t const data[size]){
+
+    gpio_set_direction(pin, GPIO_MODE_INPUT);
+    if (gpio_get_level(pin) == 0) return true;
+
+    taskENTER_CRITICAL(&criticalMutex);
+
+    //sync signal
+    gpio_set_level(pin, 0);
+    gpio_set_direction(pin, GPIO_MODE_OUTPUT);
+    Delay(delays[0]);
+
+    //bit sync signal
+    gpio_set_direction(pin, GPIO_MODE_INPUT);
+    Delay(delays[1]);
+
+    gpio_set_direction(pin, GPIO_MODE_OUTPUT);
+    gpio_set_level(pin, 0);
+    Delay(delays[1]);
+
+    const bool collision = s_SendBytes(pin, size, data, (unsigned[3]){delays[2], delays[3], 150});
+
+    taskEXIT_CRITICAL(&criticalMutex);
+
+    gpio_set_direction(pin, GPIO_MODE_INPUT);
+
+    return collision;
+}
+
+/*!
+ * @brief priority delay of a message that already collided
+ * @param slot = delta/4 in cycles
+ */
+static esp_cpu_cycle_count_t s_RetryDelay(const DCP_Handle* bus, const uint8_t retries, const esp_cpu_cycle_count_t slot){
+
+    const struct DCP_RetryPolicy_t retryPolicy = bus->retryPolicy;
+    const uint8_t addr = bus->busMode.addr;
+    unsigned slots = addr + 6;
+
+    //aging, the longer a message waits the closer it gets to the top priority
+    if (retryPolicy.agingStep){
+        const unsigned boost = retries / retryPolicy.agingStep;
+        slots -= boost < addr? boost: addr;
+    }
+
+    //back-off, esp_random is the hardware RNG so every node draws its own
+    if (retryPolicy.window){
+        const uint8_t exp = retries < retryPolicy.window? retries: retryPolicy.window;
+
+        slots += 4 * (esp_random() & ((1UL << exp) - 1));
+    }
+
+    return slots * slot;
+}
+
+static bool s_Late(const struct DCP_TXItem_t* item){
+    return item->hasDeadline && (int32_t)(xTaskGetTickCount() - item->deadline) > 0;
+}
+
+//hands the message back to the sender
+static void s_Complete(struct DCP_TXItem_t* item, enum DCP_TXStatus_e status){
+
+    free(item->data);
+
+    if (status == TX_sent && s_Late(item)){
+        status = TX_late;
+    }
+
+    const struct DCP_TXStatus_t report = {
+        .status = status,
+        .retries = item->retries,
+        .latency = item->wire? item->wire - item->enqueued: 0
+    };
+
+    if (item->status){
+        item->status->retries = report.retries;
+        item->status->latency = report.latency;
+        item->status->status = report.status;
+    }
+
+    if (item->onDone){
+        item->onDone(&report, item->ctx);
+    }
+
+    if (item->notify){
+        xTaskNotify(item->notify, status, eSetValueWithOverwrite);
+    }
+
+    *item = (struct DCP_TXItem_t){0};
+}
+
+//drops the message if its deadline passed and it must not go late
+static bool s_Expired(struct DCP_TXItem_t* item){
+
+    if (item->late || !s_Late(item)) return false;
+
+    ESP_LOGD(TAG, "message deadline passed, dropping it");
+    s_Complete(item, TX_expired);
+
+    return true;
+}
+
 /*!
  * @brief task that controls the state machine of the control of the bus
  *
  *
  */
-void _Noreturn busHandler(void* arg){
+void busHandler(void* arg){
+
+    DCP_Handle* const bus = arg;
 
-    const gpio_num_t pin = *((gpio_num_t*)arg);
+    //DCPInit attaches the ISR before it lets the task run
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    const gpio_num_t pin = bus->pin;
     enum {STARTING, LISTENING, SENDING, WAITING, READING, END_} state = WAITING;
 
     //precalculations
     const uint32_t freqMHz = esp_clk_cpu_freq()/1e6;
 
-    //TODO change this BS
-#ifdef CONFIG_IDF_TARGET_ESP32C3
-
-    //negative skews in us to be added to the timings
-    const unsigned int skews[4][5] = {
-        //listening, sync, bitsync, 0, 1
-        {0, 20, 0, 4, 4},
-        {0, 25, 0, 2, 1},
-        {0, 20, 0, 2, 2},
-        {0, 20, 0, 1, 0}
-    };
-
-#else 
-
-    const unsigned int skews[4][4] = {
-        {0, 0, 0, 0},
-        {0, 0, 0, 0},
-        {0, 0, 0, 0},
-        {0, 0, 0, 0}
-    };
-
-#endif
+    uint32_t frameDelays[4];
+    DCPFrameDelays(bus->busMode.speed, bus->busMode.isController, NULL, frameDelays);
 
     const uint32_t delays[] = {
-        (busMode.addr + 6) * configParam.delta/4.0 * freqMHz,
-        ((busMode.isController?25:50) * configParam.delta-skews[busMode.speed][1])*freqMHz,
-        (configParam.delta-skews[busMode.speed][3])*freqMHz,
-        (2*configParam.delta-skews[busMode.speed][4])*freqMHz
+        (bus->busMode.addr + 6) * bus->configParam.delta/4.0 * freqMHz,
+        frameDelays[0],
+        frameDelays[2],
+        frameDelays[3]
     };
 
     ESP_LOGV(TAG, "calculated delays:\n\tlistening: %lu cycles\n\tsync: %lu cycles\n\tbit 0: %lu cycles\n\tbit 1: %lu cycles", delays[0], delays[1], delays[2], delays[3]);
 
+    const esp_cpu_cycle_count_t slot = bus->configParam.delta/4.0 * freqMHz;
+
     //variables
     size_t rbSize;
     uint8_t* rbItem;
+    struct DCP_TXItem_t item = {0};
     DCP_Data_t message = {0};
+    esp_cpu_cycle_count_t priority = delays[0];
     bool collision = false;
 
-    assert(RXmessageQueue != NULL);
-    assert(TXmessageQueue != NULL);
+    assert(bus->RXmessageQueue != NULL);
+    for (int p = 0; p < TX_PRIORITY_COUNT; ++p){
+        assert(bus->TXmessageQueue[p] != NULL);
+    }
 
     gpio_set_direction(pin, GPIO_MODE_INPUT);
 
-    while(1){
+    while(!bus->stopping){
 
 #ifdef DEBUG_PIN
         gpio_set_level(DEBUG_PIN, 0);
@@ -240,10 +459,10 @@ void _Noreturn busHandler(void* arg){
 #ifdef DEBUG_PIN
                 gpio_set_level(DEBUG_PIN, 1);
 #endif
-                ulTaskNotifyValueClear(busTask, UINT_MAX);
+                ulTaskNotifyValueClear(bus->busTask, UINT_MAX);
                 //protocol piority delay
                 //devices with smaller addresses will have the priority
-                Delay(delays[0]);
+                Delay(priority);
 
                 //while in the delay, did someone take the bus?
                 if(ulTaskNotifyTake(pdTRUE, 0)){
@@ -266,6 +485,7 @@ void _Noreturn busHandler(void* arg){
                 }
 
                 //sync signal
+                item.wire = esp_timer_get_time();
                 (void)gpio_set_direction(pin, GPIO_MODE_OUTPUT);
 
                 Delay(delays[1]);
@@ -310,15 +530,32 @@ void _Noreturn busHandler(void* arg){
 #endif
                 if (collision){
                     ESP_LOGV(TAG, "Collision detected");
+
+                    if (item.retries < UINT8_MAX) item.retries++;
+                    if (item.status) item.status->retries = item.retries;
+
+                    if (bus->retryPolicy.maxRetries && item.retries >= bus->retryPolicy.maxRetries){
+                        ESP_LOGW(TAG, "dropping message after %u collisions", item.retries);
+                        s_Complete(&item, TX_dropped);
+                        state = WAITING;
+                        continue;
+                    }
+
+                    if (s_Expired(&item)){
+                        state = WAITING;
+                        continue;
+                    }
+
+                    priority = s_RetryDelay(bus, item.retries, slot);
                     state = LISTENING;
                     continue;
                 }
 
-                free(message.data);
+                s_Complete(&item, TX_sent);
 
                 ESP_LOGV(TAG, "successfully sent message, going to wait mode");
 
-                ulTaskNotifyValueClear(busTask, UINT_MAX);
+                ulTaskNotifyValueClear(bus->busTask, UINT_MAX);
                 gpio_set_direction(pin, GPIO_MODE_INPUT);
 
                 __attribute__((fallthrough));
@@ -327,57 +564,95 @@ void _Noreturn busHandler(void* arg){
                 state = WAITING;
 
                 //message to read
-                if( (rbItem = xRingbufferReceive(isrBuf, &rbSize, 1)) != NULL ){
+                if( (rbItem = xRingbufferReceive(bus->isrBuf, &rbSize, 1)) != NULL ){
                     state = READING;
                     break;
                 }
                  
-                //message to send
-                if (xQueueReceive(TXmessageQueue, &(message.data), 1) == pdPASS){
+                //message to send, one that collided is kept until it goes out or is dropped
+                //the most urgent queue goes first, only the last one blocks
+                for (int p = 0; p < TX_PRIORITY_COUNT && item.data == NULL; ++p){
+                    if (xQueueReceive(bus->TXmessageQueue[p], &item, p == TX_PRIORITY_COUNT-1? 1: 0) == pdPASS){
+                        priority = delays[0];
+                    }
+                }
+
+                if (item.data != NULL && !s_Expired(&item)){
+                    message.data = item.data;
                     state = LISTENING;
-                    break;
                 }
 
                 break;
-            case READING:
-                message.data = malloc(rbSize * sizeof(uint8_t));
-                memmove(message.data, rbItem, rbSize);
+            case READING: {
+                taskENTER_CRITICAL(&criticalMutex);
+                const DCP_RXCallback_t onReceive = bus->rxCallback;
+                void* const ctx = bus->rxContext;
+                taskEXIT_CRITICAL(&criticalMutex);
+
+                //the callback reads the frame in place, no copy nor queue
+                if (onReceive){
+                    onReceive((const struct DCP_Message_t*)rbItem, rbSize, ctx);
+                    vRingbufferReturnItem(bus->isrBuf, rbItem);
+
+                    state = WAITING;
+                    break;
+                }
 
-                vRingbufferReturnItem(isrBuf, rbItem);
+                uint8_t* const received = malloc(rbSize * sizeof(uint8_t));
+                memmove(received, rbItem, rbSize);
 
-                xQueueSend(RXmessageQueue, &(message.data), pdMS_TO_TICKS(15));
+                vRingbufferReturnItem(bus->isrBuf, rbItem);
+
+                xQueueSend(bus->RXmessageQueue, &received, pdMS_TO_TICKS(15));
 
                 state = WAITING;
                 break;
+            }
             default:
                 ESP_LOGE(TAG, "this code should not be executed, possible corruption");
                 break;
         }
     }
+
+    //the message taken from the queue is the only one DCPDeinit cannot see
+    if (item.data != NULL) s_Complete(&item, TX_dropped);
+
+    bus->busTask = NULL;
+    vTaskDelete(NULL);
 }
 
-bool DCPInit(const unsigned int busPin, const DCP_MODE mode){
+DCP_Handle* DCPInit(const unsigned int busPin, const DCP_MODE mode){
 
-    if (mode.addr == 0) return false;
+    if (mode.addr == 0) return NULL;
 
-    gpio_num_t pin = busPin;
-    CLOCK_TO_TIME = 1.0/esp_clk_cpu_freq();
+    DCP_Handle* const bus = calloc(1, sizeof(DCP_Handle));
+    if (!bus){
+        ESP_LOGE(TAG, "could not allocate the bus");
 
-    busMode = mode;
-    configParam.delta = deltaLUT[busMode.speed];
-    configParam.moe = .02*configParam.delta;
+        return NULL;
+    }
 
-    configParam.limits[0] = ((configParam.delta - configParam.moe)*1e-6)/CLOCK_TO_TIME;
-    configParam.limits[1] = ((configParam.delta + configParam.moe)*1e-6)/CLOCK_TO_TIME;
+    const gpio_num_t pin = busPin;
 
-    ESP_LOGV(TAG, "transmission limits: [%lu ~ %lu]ticks", configParam.limits[0], configParam.limits[1]);
-    ESP_LOGV(TAG, "transmission limits: [%.2f ~ %.2f]us", configParam.delta - configParam.moe, configParam.delta + configParam.moe);
+    bus->pin = pin;
+    bus->busMode = mode;
+    bus->retryPolicy = defaultPolicy;
+    bus->configParam = *DCPSpeedTiming(bus->busMode.speed);
 
-    if (busMode.addr != 0){
-        busMode = mode;
-        return true;
+    bus->filtering = mode.broadcast;
+    for (int i = 0; i < sizeof(mode.accept)/sizeof(mode.accept[0]); ++i){
+        bus->filtering |= mode.accept[i] != 0;
     }
 
+    ESP_LOGV(TAG, "transmission limits: [%lu ~ %lu]ticks", bus->configParam.limits[0], bus->configParam.limits[1]);
+    ESP_LOGV(TAG, "transmission limits: [%.2f ~ %.2f]us", bus->configParam.delta - bus->configParam.moe, bus->configParam.delta + bus->configParam.moe);
+
+#if !CONFIG_DCP_BUS_TASK
+    //validator only build, the handle carries the timing and the pin is driven by the tests,
+    //the send and read calls refuse it
+    return bus;
+#else
+
 #ifdef DEBUG_PIN
     gpio_set_direction(DEBUG_PIN, GPIO_MODE_OUTPUT);
 #endif
@@ -389,72 +664,155 @@ bool DCPInit(const unsigned int busPin, const DCP_MODE mode){
         .pull_up_en = true
     };
     
-    if(gpio_config(&conf)) return false;
+    if(gpio_config(&conf)){
+        free(bus);
+        return NULL;
+    }
     
-    /*
-    RXmessageQueue = xQueueCreate(8, sizeof(uint8_t*));
-    if (!RXmessageQueue){
+    bus->RXmessageQueue = xQueueCreate(8, sizeof(uint8_t*));
+    if (!bus->RXmessageQueue){
         ESP_LOGE(TAG, "could not create RX message queue");
 
-        return false;
+        free(bus);
+        return NULL;
     } 
     ESP_LOGD(TAG, "RX queue created");
 
-    TXmessageQueue = xQueueCreate(8, sizeof(uint8_t*));
-    if (!TXmessageQueue){
-        ESP_LOGE(TAG, "could not create TX message queue");
+    for (int p = 0; p < TX_PRIORITY_COUNT; ++p){
+        bus->TXmessageQueue[p] = xQueueCreate(8, sizeof(struct DCP_TXItem_t));
+        if (!bus->TXmessageQueue[p]){
+            ESP_LOGE(TAG, "could not create TX message queue");
 
-        vQueueDelete(RXmessageQueue);
+            while (p--) vQueueDelete(bus->TXmessageQueue[p]);
+            vQueueDelete(bus->RXmessageQueue);
 
-        return false;
-    } 
-    ESP_LOGD(TAG, "TX queue created");
+            free(bus);
+            return NULL;
+        } 
+    }
+    ESP_LOGD(TAG, "TX queues created");
 
-    isrBuf = xRingbufferCreate(0xFF0, RINGBUF_TYPE_NOSPLIT);
-    if(isrBuf == NULL){
+    bus->isrBuf = xRingbufferCreate(0xFF0, RINGBUF_TYPE_NOSPLIT);
+    if(bus->isrBuf == NULL){
         ESP_LOGE(TAG, "could not create ISR buffer");
 
-        vQueueDelete(RXmessageQueue);
-        vQueueDelete(TXmessageQueue);
+        vQueueDelete(bus->RXmessageQueue);
+        for (int p = 0; p < TX_PRIORITY_COUNT; ++p) vQueueDelete(bus->TXmessageQueue[p]);
 
-        return false;
+        free(bus);
+        return NULL;
     }
     ESP_LOGD(TAG, "ISR ringbuffer created");
 
-    if(gpio_install_isr_service(ESP_INTR_FLAG_LEVEL3) || gpio_isr_handler_add(pin, BusISR, (void*)pin)){
+    //the task waits for the ISR, an edge right after the ISR is attached already has a task to notify
+    xTaskCreate(busHandler, "DCP bus handler", 2*1024, bus, configMAX_PRIORITIES-2, &bus->busTask);
+
+    if (!bus->busTask){
+        ESP_LOGE(TAG, "could not create bus arbitrator task");
+
+        vQueueDelete(bus->RXmessageQueue);
+        for (int p = 0; p < TX_PRIORITY_COUNT; ++p) vQueueDelete(bus->TXmessageQueue[p]);
+
+        vRingbufferDelete(bus->isrBuf);
+
+        free(bus);
+        return NULL;
+    }
+
+    //the ISR service is shared by every bus, only the first one installs it
+    const esp_err_t service = gpio_install_isr_service(ESP_INTR_FLAG_LEVEL3);
+
+    if((service != ESP_OK && service != ESP_ERR_INVALID_STATE) || gpio_isr_handler_add(pin, BusISR, bus)){
         ESP_LOGE(TAG, "could not register gpio ISR");
 
-        vQueueDelete(RXmessageQueue);
-        vQueueDelete(TXmessageQueue);
+        //still blocked before its loop, it holds nothing
+        vTaskDelete(bus->busTask);
 
-        vRingbufferDelete(isrBuf);
+        vQueueDelete(bus->RXmessageQueue);
+        for (int p = 0; p < TX_PRIORITY_COUNT; ++p) vQueueDelete(bus->TXmessageQueue[p]);
 
-        return false;
+        vRingbufferDelete(bus->isrBuf);
+
+        free(bus);
+        return NULL;
     }
     ESP_LOGD(TAG, "Installed ISR handler");
 
+    xTaskNotifyGive(bus->busTask);
+    ESP_LOGI(TAG, "bus arbitrator task created");
 
-    xTaskCreate(busHandler, "DCP bus handler", 2*1024, &pin, configMAX_PRIORITIES-2, &busTask);
+    return bus;
+#endif
+}
 
-    if (!busTask){
-        ESP_LOGE(TAG, "could not create bus arbitrator task");
+void DCPDeinit(DCP_Handle* bus){
 
-        vQueueDelete(RXmessageQueue);
-        vQueueDelete(TXmessageQueue);
+    if (!bus) return;
 
-        gpio_uninstall_isr_service();
+    if (bus->busTask){
+        //no ISR may notify the task once it is gone
+        gpio_isr_handler_remove(bus->pin);
 
-        vRingbufferDelete(isrBuf);
+        //the task drops the message it holds, the queued ones are dropped below
+        bus->stopping = true;
+        while (bus->busTask) vTaskDelay(1);
+    }
 
-        return false;
+    for (int p = 0; p < TX_PRIORITY_COUNT; ++p){
+        if (!bus->TXmessageQueue[p]) continue;
+
+        //whoever waits on them hears they are not going out
+        struct DCP_TXItem_t item;
+        while (xQueueReceive(bus->TXmessageQueue[p], &item, 0) == pdPASS){
+            s_Complete(&item, TX_dropped);
+        }
+
+        vQueueDelete(bus->TXmessageQueue[p]);
     }
-    ESP_LOGI(TAG, "bus arbitrator task created");
-    */
 
-    return true;
+    if (bus->RXmessageQueue){
+        uint8_t* data;
+        while (xQueueReceive(bus->RXmessageQueue, &data, 0) == pdPASS){
+            free(data);
+        }
+
+        vQueueDelete(bus->RXmessageQueue);
+    }
+
+    if (bus->isrBuf){
+        vRingbufferDelete(bus->isrBuf);
+    }
+
+    free(bus);
+}
+
+const struct DCP_Timing_t* DCPTiming(const DCP_Handle* bus){
+    return &bus->configParam;
+}
+
+void DCPSetRetryPolicy(DCP_Handle* bus, const struct DCP_RetryPolicy_t policy){
+    bus->retryPolicy = policy;
+}
+
+//only a bus with its task has the queues, see CONFIG_DCP_BUS_TASK
+static bool s_Running(const DCP_Handle* bus){
+
+    if (bus->busTask) return true;
+
+    ESP_LOGE(TAG, "the bus task is not running");
+    return false;
 }
 
-bool SendMessage(const DCP_Data_t message){
+static bool s_Enqueue(DCP_Handle* bus, const DCP_Data_t message, struct DCP_TXStatus_t* status, const struct DCP_SendParams_t params, const TickType_t wait){
+
+    if (!s_Running(bus)){
+        if (status) *status = (struct DCP_TXStatus_t){.status = TX_dropped};
+        return false;
+    }
+
+    if (message.message->type == 0){
+        DCPStampL3(&message.message->L3);
+    }
 
 #ifdef ESP_LOGD
     if (message.message->type){
@@ -465,20 +823,85 @@ bool SendMessage(const DCP_Data_t message){
 #endif
 
 
-    if (xQueueSend(TXmessageQueue, (void*)&(message.data), portMAX_DELAY) != pdTRUE){
+    if (status){
+        *status = (struct DCP_TXStatus_t){.status = TX_pending};
+    }
+
+    const struct DCP_TXItem_t item = {
+        .data = message.data,
+        .status = status,
+        .late = params.late,
+        .hasDeadline = params.deadlineMs != 0,
+        .deadline = xTaskGetTickCount() + pdMS_TO_TICKS(params.deadlineMs),
+        .onDone = params.onDone,
+        .ctx = params.ctx,
+        .notify = params.notify,
+        .enqueued = esp_timer_get_time()
+    };
+
+    if (params.priority >= TX_PRIORITY_COUNT || xQueueSend(bus->TXmessageQueue[params.priority], &item, wait) != pdTRUE){
         ESP_LOGE(TAG, "could not send message to queue");
+        //never queued, nothing else will complete it
+        if (status) status->status = TX_dropped;
         return false;
     }
 
     return true;
 }
 
-struct DCP_Message_t* ReadMessage(){
+bool SendMessage(DCP_Handle* bus, const DCP_Data_t message){
+    return SendMessageStatus(bus, message, NULL);
+}
+
+bool SendMessageStatus(DCP_Handle* bus, const DCP_Data_t message, struct DCP_TXStatus_t* status){
+    return s_Enqueue(bus, message, status, (struct DCP_SendParams_t){.priority = TX_PRIORITY_normal}, portMAX_DELAY);
+}
+
+struct DCP_TXStatus_t* SendMessageAsync(DCP_Handle* bus, const DCP_Data_t message, const struct DCP_SendParams_t params){
+
+    struct DCP_TXStatus_t* status = NULL;
+
+    taskENTER_CRITICAL(&criticalMutex);
+    for (int i = 0; i < CONFIG_DCP_TX_HANDLES; ++i){
+        if (!statusPool[i].used){
+            statusPool[i].used = true;
+            status = &statusPool[i].status;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&criticalMutex);
+
+    if (!status){
+        ESP_LOGW(TAG, "no free TX status handle");
+        return NULL;
+    }
+
+    if (!s_Enqueue(bus, message, status, params, 0)){
+        DCPReleaseStatus(status);
+        return NULL;
+    }
+
+    return status;
+}
+
+void DCPReleaseStatus(struct DCP_TXStatus_t* status){
+
+    for (int i = 0; i < CONFIG_DCP_TX_HANDLES; ++i){
+        if (&statusPool[i].status == status){
+            statusPool[i].used = false;
+            return;
+        }
+    }
+}
+
+struct DCP_Message_t* ReadMessage(DCP_Handle* bus){
 
     DCP_Data_t message = {0};
 
-    if ((busMode.flags.flags & 0x1) == FLAG_Instant){
-        if (xQueueReceive(RXmessageQueue, &(message.data), 0) == pdTRUE){
+    if (!s_Running(bus)) return NULL;
+
+    if ((bus->busMode.flags.flags & 0x1) == FLAG_Instant){
+        if (xQueueReceive(bus->RXmessageQueue, &(message.data), 0) == pdTRUE){
 
 #ifdef ESP_LOGD
             if (message.message->type){
@@ -501,7 +924,7 @@ struct DCP_Message_t* ReadMessage(){
         return NULL;
     }
 
-    if (xQueueReceive(RXmessageQueue, &(message.data), portMAX_DELAY) == pdTRUE){
+    if (xQueueReceive(bus->RXmessageQueue, &(message.data), portMAX_DELAY) == pdTRUE){
 
 #ifdef ESP_LOGD
             if (message.message->type){
@@ -523,3 +946,25 @@ struct DCP_Message_t* ReadMessage(){
 
     return NULL;
 }
+
+size_t ReadMessages(DCP_Handle* bus, struct DCP_Message_t* messages[], const size_t max, const uint32_t timeoutMs){
+
+    size_t count = 0;
+    const TickType_t wait = timeoutMs == UINT32_MAX? portMAX_DELAY: pdMS_TO_TICKS(timeoutMs);
+
+    if (!s_Running(bus)) return 0;
+
+    //only the first one waits, the rest are taken while the task is already awake
+    while (count < max && xQueueReceive(bus->RXmessageQueue, &messages[count], count? 0: wait) == pdTRUE){
+        ++count;
+    }
+
+    return count;
+}
+
+void DCPSetRXCallback(DCP_Handle* bus, const DCP_RXCallback_t onReceive, void* ctx){
+    taskENTER_CRITICAL(&criticalMutex);
+    bus->rxCallback = onReceive;
+    bus->rxContext = ctx;
+    taskEXIT_CRITICAL(&criticalMutex);
+}
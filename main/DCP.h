@@ -9,6 +9,11 @@ extern "C" {
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "esp_cpu.h"
+
 enum e_Flags {
     FLAG_Instant        = 0b0,
     FLAG_Assynchronous  = 0b1
@@ -16,6 +21,9 @@ enum e_Flags {
 
 enum DCP_Speed_e {SLOW = 0, FAST1, FAST2, ULTRA};
 
+//no node can take address 0, frames sent to it are for everyone
+#define DCP_BROADCAST 0x00
+
 typedef struct DCP_MODE{
     uint8_t addr;
     union{
@@ -24,9 +32,35 @@ typedef struct DCP_MODE{
     } flags;
     bool isController;
     enum DCP_Speed_e speed;
+
+    //destination filter of the received frames, off while no bit is set and broadcast is false
+    //frames for other nodes are dropped by the ISR as soon as the destination is read
+    uint32_t accept[256/32];    //bit n accepts destination n
+    bool broadcast;             //accept DCP_BROADCAST too
 }DCP_MODE;
 
-bool DCPInit(const unsigned int busPin, const DCP_MODE mode);
+static inline void DCPAccept(DCP_MODE* mode, const uint8_t addr){
+    mode->accept[addr >> 5] |= 1UL << (addr & 0x1F);
+}
+
+//state of one bus, several buses can run on different pins
+typedef struct DCP_Handle DCP_Handle;
+
+//timing of a bus
+struct DCP_Timing_t {
+    float delta;    //transmission time unit
+    float moe;      //transmission margin of error
+    esp_cpu_cycle_count_t limits[2];
+};
+
+//NULL on failure. Without CONFIG_DCP_BUS_TASK the handle only carries the bus timing,
+//the send and read calls fail on it
+DCP_Handle* DCPInit(const unsigned int busPin, const DCP_MODE mode);
+//stops the bus, queued messages are dropped
+void DCPDeinit(DCP_Handle* bus);
+const struct DCP_Timing_t* DCPTiming(const DCP_Handle* bus);
+//limits of a speed class with the default margin of error, the same a bus of that speed gets
+const struct DCP_Timing_t* DCPSpeedTiming(const enum DCP_Speed_e speed);
 
 struct DCP_Message_L3_t{
     uint8_t SOH;        //header
@@ -58,8 +92,91 @@ typedef union {
     uint8_t * data;
 } DCP_Data_t;
 
-bool SendMessage(const DCP_Data_t message);
-struct DCP_Message_t* ReadMessage();
+//L3 constant fields
+#define DCP_L3_SOH  0x01
+#define DCP_L3_PAD  0x00
+
+/*!
+ * @brief CRC-8 (poly 0x07, init 0x00) of the L3 frames, from SOH to PAD
+ */
+uint8_t DCPCRC8(const uint8_t* data, const size_t size);
+//sets the constant fields and the CRC of an outgoing L3 frame
+void DCPStampL3(struct DCP_Message_L3_t* message);
+
+/*!
+ * @brief what the bus handler does after a collision
+ *
+ * the retry is delayed by the address priority delay, minus one slot of
+ * delta/4 for every agingStep collisions of the message, plus a random
+ * back-off of up to 2^min(retries, window) - 1 deltas
+ */
+struct DCP_RetryPolicy_t {
+    uint8_t maxRetries;     //collisions before the message is dropped, 0 for no limit
+    uint8_t window;         //back-off window exponent cap, 0 disables the back-off
+    uint8_t agingStep;      //0 disables the aging
+};
+
+void DCPSetRetryPolicy(DCP_Handle* bus, const struct DCP_RetryPolicy_t policy);
+
+enum DCP_TXStatus_e {
+    TX_pending = 0,
+    TX_sent,
+    TX_dropped,     //too many collisions, not queued or the bus stopped
+    TX_late,        //sent after its deadline
+    TX_expired      //deadline passed before it went out, not sent
+};
+
+//filled by the bus handler as the message goes out
+struct DCP_TXStatus_t {
+    volatile enum DCP_TXStatus_e status;
+    volatile uint8_t retries;       //collisions of the message
+    volatile uint32_t latency;      //us from the send call to the last sync on the wire, 0 if none
+};
+
+//called from the bus task once the message is done with, it must not block
+typedef void (*DCP_TXCallback_t)(const struct DCP_TXStatus_t* status, void* ctx);
+
+//each level has its own queue, a lower level always goes first
+enum DCP_TXPriority_e {TX_PRIORITY_urgent = 0, TX_PRIORITY_normal, TX_PRIORITY_bulk, TX_PRIORITY_COUNT};
+
+struct DCP_SendParams_t {
+    enum DCP_TXPriority_e priority;
+    uint32_t deadlineMs;    //from the send call, 0 for none
+    bool late;              //send it anyway after the deadline, reported as TX_late
+
+    //completion, both optional
+    DCP_TXCallback_t onDone;
+    void* ctx;
+    TaskHandle_t notify;    //notified with the DCP_TXStatus_e as value
+};
+
+bool SendMessage(DCP_Handle* bus, const DCP_Data_t message);
+//status may be NULL, it must live until the message is sent or dropped
+bool SendMessageStatus(DCP_Handle* bus, const DCP_Data_t message, struct DCP_TXStatus_t* status);
+
+/*!
+ * @brief queues the message without blocking
+ * @return status handle, NULL if the queue of its priority is full or no handle is free
+ *
+ * the handle is owned by the sender until DCPReleaseStatus, which must only be
+ * called once the status is no longer TX_pending. On NULL the message is not freed
+ */
+struct DCP_TXStatus_t* SendMessageAsync(DCP_Handle* bus, const DCP_Data_t message, const struct DCP_SendParams_t params);
+void DCPReleaseStatus(struct DCP_TXStatus_t* status);
+struct DCP_Message_t* ReadMessage(DCP_Handle* bus);
+
+/*!
+ * @brief waits up to timeoutMs for a message, then takes every other one already queued
+ * @return messages written, each must be freed by the caller
+ */
+size_t ReadMessages(DCP_Handle* bus, struct DCP_Message_t* messages[], const size_t max, const uint32_t timeoutMs);
+
+//called from the bus task for every received frame, which then skips the RX queue
+//the message is only valid during the call and the callback must not block
+typedef void (*DCP_RXCallback_t)(const struct DCP_Message_t* message, const size_t size, void* ctx);
+
+//NULL goes back to the RX queue
+void DCPSetRXCallback(DCP_Handle* bus, const DCP_RXCallback_t onReceive, void* ctx);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <driver/gpio.h>
+
+#include "DCP.h"
+
+///////////////////////////////////////////////////////////////
+//frame level helpers of the driver, for the validator tests that drive the bus themselves
+
+//cycles of the sync, each bit sync half, bit 0 high and bit 1 high, scales stretch them (NULL for nominal)
+//false if a width is shorter than the software overhead of sending it, that delay is then 0
+bool DCPFrameDelays(const enum DCP_Speed_e speed, const bool isController, const float scales[4], uint32_t delays[4]);
+//sends a whole frame without the priority delay, true on collision or if the bus was taken
+bool DCPSendFrame(gpio_num_t const pin, uint32_t const delays[restrict 4], uint8_t const size, uint8_t const data[size]);
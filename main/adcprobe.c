@@ -0,0 +1,329 @@
+#include "adcprobe.h"
+
+#include <esp_adc/adc_continuous.h>
+#include <esp_adc/adc_cali_scheme.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include "sdkconfig.h"
+
+#include <assert.h>
+#include <string.h>
+
+static const char* TAG = "ADCProbe";
+
+//full scale of the 12 bit reading, 0-2.5V with 11dB on the C3
+#define ADC_FULL_SCALE 4096
+#define ADC_FULL_SCALE_MV 2500
+
+//the histogram drops the 4 least significant bits
+#define ADC_BIN_SHIFT 4
+#define ADC_BINS (ADC_FULL_SCALE >> ADC_BIN_SHIFT)
+
+//plateaus closer than this, in bins, are the same level
+#define ADC_MIN_SPLIT (ADC_BINS/8)
+
+#define ADC_FRAME_BYTES 256
+
+///////////////////////////////////////////////////////////////
+
+static uint32_t histogram[ADC_BINS];
+static uint8_t frame[ADC_FRAME_BYTES];
+
+static struct s_Edges_t{
+    uint32_t low, high;         //10% and 90% levels, raw
+    enum {LEVEL_unknown, LEVEL_low, LEVEL_high} level;
+    uint32_t pending;           //samples between the levels since the last plateau
+    uint32_t rising, falling;
+    uint32_t riseSamples, fallSamples;
+} edges;
+
+static struct s_Session_t{
+    adc_continuous_handle_t handle;
+    gpio_num_t pin;
+    adc_unit_t unit;
+    adc_channel_t channel;
+    enum {PHASE_plateaus, PHASE_edges, PHASE_done} phase;
+    uint32_t phaseSamples;      //samples of each half of the window
+    uint32_t samples;           //of the current phase
+    uint32_t total;
+    float low, high;            //plateaus, raw
+    bool hasLow, hasHigh;
+    bool timed;                 //every plateau holds a sample, the edges can be told apart
+} session;
+
+static void s_Histogram(const uint32_t raw){
+    histogram[raw >> ADC_BIN_SHIFT]++;
+}
+
+static void s_Edges(const uint32_t raw){
+
+    if (raw > edges.low && raw < edges.high){
+        edges.pending++;
+        return;
+    }
+
+    const bool high = raw >= edges.high;
+
+    if (edges.level == LEVEL_low && high){
+        edges.rising++;
+        edges.riseSamples += edges.pending;
+    }else if (edges.level == LEVEL_high && !high){
+        edges.falling++;
+        edges.fallSamples += edges.pending;
+    }
+
+    //a glitch that goes back to the same plateau is not an edge
+    edges.pending = 0;
+    edges.level = high? LEVEL_high: LEVEL_low;
+}
+
+//mean raw reading of the bins in [from, to)
+static float s_Mean(const uint32_t from, const uint32_t to){
+    uint64_t sum = 0, count = 0;
+
+    for (uint32_t i = from; i < to; ++i){
+        sum += (uint64_t)histogram[i] * ((i << ADC_BIN_SHIFT) + (1 << (ADC_BIN_SHIFT-1)));
+        count += histogram[i];
+    }
+
+    return count? (float)sum/count: 0;
+}
+
+//bin below which the given fraction of the samples lies
+static uint32_t s_Percentile(const uint32_t samples, const float fraction){
+    const uint64_t target = samples * fraction;
+    uint64_t count = 0;
+
+    for (uint32_t i = 0; i < ADC_BINS; ++i){
+        count += histogram[i];
+        if (count > target) return i;
+    }
+
+    return ADC_BINS-1;
+}
+
+//end of the first half, finds the plateaus and the edge levels
+static void s_Plateaus(void){
+
+    //the DUT may be silent most of the window, the low plateau can be a few percent of it
+    const uint32_t bottom = s_Percentile(session.samples, .002);
+    const uint32_t top = s_Percentile(session.samples, .998);
+
+    if (session.samples && top - bottom >= ADC_MIN_SPLIT){
+        //only the outer quarters, the edge samples stay out of the means
+        const uint32_t quarter = (top - bottom)/4;
+
+        session.low = s_Mean(0, bottom + quarter + 1);
+        session.high = s_Mean(top - quarter, ADC_BINS);
+        session.hasLow = session.hasHigh = true;
+    }else if (session.samples){
+        //one level, the bus idles high unless it is stuck low
+        const float level = s_Mean(0, ADC_BINS);
+
+        if (bottom < ADC_MIN_SPLIT){
+            session.low = level;
+            session.hasLow = true;
+        }else{
+            session.high = level;
+            session.hasHigh = true;
+        }
+    }
+
+    //without both plateaus there are no edges to time
+    if (!session.hasLow || !session.hasHigh){
+        session.phase = PHASE_done;
+        return;
+    }
+
+    memset(&edges, 0, sizeof(edges));
+    edges.low = session.low + .1*(session.high - session.low);
+    edges.high = session.low + .9*(session.high - session.low);
+
+    session.phase = PHASE_edges;
+    session.samples = 0;
+}
+
+static float s_Volts(adc_cali_handle_t cali, const float raw){
+    int mv = raw * ADC_FULL_SCALE_MV / ADC_FULL_SCALE;
+
+    if (cali) adc_cali_raw_to_voltage(cali, raw, &mv);
+
+    //the pin may sit behind a divider
+    return mv / (float)CONFIG_DCP_ADC_DIVIDER;
+}
+
+static void s_RestorePad(const gpio_num_t pin){
+    gpio_set_direction(pin, GPIO_MODE_INPUT);
+    gpio_pullup_en(pin);
+}
+
+///////////////////////////////////////////////////////////////
+
+bool ADCProbeStart(const gpio_num_t pin, const uint32_t windowMs, const float plateauUs){
+
+    assert(!session.handle);
+    memset(&session, 0, sizeof(session));
+    memset(histogram, 0, sizeof(histogram));
+
+    //shorter plateaus are stepped over, the band samples of several edges would add up as one
+    session.timed = plateauUs * CONFIG_DCP_ADC_RATE > 1e6f;
+
+    if (adc_continuous_io_to_channel(pin, &session.unit, &session.channel) != ESP_OK || session.unit != ADC_UNIT_1){
+        ESP_LOGW(TAG, "GPIO %d has no ADC1 channel", pin);
+        return false;
+    }
+
+    const adc_continuous_handle_cfg_t handleConfig = {
+        .max_store_buf_size = 32*ADC_FRAME_BYTES,
+        .conv_frame_size = ADC_FRAME_BYTES
+    };
+
+    if (adc_continuous_new_handle(&handleConfig, &session.handle) != ESP_OK){
+        ESP_LOGE(TAG, "Error creating the ADC handle");
+        session.handle = NULL;
+        return false;
+    }
+
+    adc_digi_pattern_config_t pattern = {
+        .atten = ADC_ATTEN_DB_11,
+        .channel = session.channel,
+        .unit = session.unit,
+        .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH
+    };
+    const adc_continuous_config_t config = {
+        .pattern_num = 1,
+        .adc_pattern = &pattern,
+        .sample_freq_hz = CONFIG_DCP_ADC_RATE,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE2
+    };
+
+    if (adc_continuous_config(session.handle, &config) != ESP_OK){
+        ESP_LOGE(TAG, "Error configuring the ADC");
+        adc_continuous_deinit(session.handle);
+        session.handle = NULL;
+        return false;
+    }
+
+    //the ADC turns the pad analog, the bus keeps its pull-up and the
+    //digital side of the validator keeps reading it
+    s_RestorePad(pin);
+
+    if (adc_continuous_start(session.handle) != ESP_OK){
+        ESP_LOGE(TAG, "Error starting the ADC");
+        adc_continuous_deinit(session.handle);
+        session.handle = NULL;
+        return false;
+    }
+
+    session.pin = pin;
+    session.phaseSamples = (uint64_t)CONFIG_DCP_ADC_RATE * windowMs / 2000;
+
+    return true;
+}
+
+bool ADCProbeDrain(const uint32_t waitMs){
+
+    if (!session.handle || session.phase == PHASE_done) return true;
+
+    uint32_t size = 0;
+
+    //only the first read waits, the rest takes what is already there
+    for (uint32_t wait = waitMs; adc_continuous_read(session.handle, frame, sizeof(frame), &size, wait) == ESP_OK; wait = 0){
+
+        for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= size; i += SOC_ADC_DIGI_RESULT_BYTES){
+            const adc_digi_output_data_t* p = (const adc_digi_output_data_t*)&frame[i];
+
+            if (p->type2.channel != session.channel) continue;
+
+            if (session.phase == PHASE_plateaus){
+                s_Histogram(p->type2.data);
+            }else{
+                s_Edges(p->type2.data);
+            }
+
+            session.total++;
+
+            if (++session.samples < session.phaseSamples) continue;
+
+            if (session.phase == PHASE_plateaus){
+                s_Plateaus();
+            }else{
+                session.phase = PHASE_done;
+            }
+
+            if (session.phase == PHASE_done) return true;
+        }
+    }
+
+    return false;
+}
+
+void ADCProbeStop(struct DCP_ADCProbe_t* ret){
+
+    memset(ret, 0, sizeof(*ret));
+
+    if (!session.handle) return;
+
+    adc_continuous_stop(session.handle);
+    adc_continuous_deinit(session.handle);
+    session.handle = NULL;
+    s_RestorePad(session.pin);
+
+    //stopped during the first half, the plateaus come from what was seen
+    if (session.phase == PHASE_plateaus) s_Plateaus();
+
+    ret->samples = session.total;
+    ret->rate = CONFIG_DCP_ADC_RATE;
+    ret->high = session.hasHigh;
+    ret->low = session.hasLow;
+
+    if (session.timed && session.phase != PHASE_plateaus && ret->high && ret->low){
+        ret->rising = edges.rising;
+        ret->falling = edges.falling;
+
+        if (edges.rising) ret->rise = (float)edges.riseSamples/edges.rising/CONFIG_DCP_ADC_RATE;
+        if (edges.falling) ret->fall = (float)edges.fallSamples/edges.falling/CONFIG_DCP_ADC_RATE;
+    }
+
+    adc_cali_handle_t cali = NULL;
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    const adc_cali_curve_fitting_config_t caliConfig = {
+        .unit_id = session.unit,
+        .chan = session.channel,
+        .atten = ADC_ATTEN_DB_11,
+        .bitwidth = ADC_BITWIDTH_DEFAULT
+    };
+    if (adc_cali_create_scheme_curve_fitting(&caliConfig, &cali) != ESP_OK){
+        ESP_LOGW(TAG, "No ADC calibration, using the nominal scale");
+        cali = NULL;
+    }
+#endif
+
+    if (ret->high) ret->VIH = s_Volts(cali, session.high);
+    if (ret->low) ret->VIL = s_Volts(cali, session.low);
+
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    if (cali) adc_cali_delete_scheme_curve_fitting(cali);
+#endif
+
+    ESP_LOGI(TAG, "%lu samples, VIH %.3f VIL %.3f, %lu rising %lu falling, rise %.3fus fall %.3fus",
+            ret->samples, ret->VIH, ret->VIL, ret->rising, ret->falling, ret->rise*1e6, ret->fall*1e6);
+}
+
+bool ADCProbe(const gpio_num_t pin, const uint32_t windowMs, const float plateauUs, struct DCP_ADCProbe_t* ret){
+
+    if (!ADCProbeStart(pin, windowMs, plateauUs)){
+        memset(ret, 0, sizeof(*ret));
+        return false;
+    }
+
+    //the window is counted in samples, the timeout only covers a stalled ADC
+    const int64_t end = esp_timer_get_time() + 2*(int64_t)windowMs*1000;
+
+    while (!ADCProbeDrain(10) && esp_timer_get_time() < end);
+
+    ADCProbeStop(ret);
+
+    return true;
+}
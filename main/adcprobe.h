@@ -0,0 +1,56 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <driver/gpio.h>
+
+///////////////////////////////////////////////////////////////
+
+/*!
+ * @brief analog view of the bus while the DUT transmits
+ *
+ * the line is sampled by the continuous ADC. The plateaus come from the
+ * histogram of the samples, the edges from the samples between the 10%
+ * and 90% levels. The ADC is much slower than an edge, but the sampling
+ * is not locked to the bit clock, so a sample lands inside an edge with a
+ * probability proportional to its length. Averaged over many edges that
+ * gives the mean 10%-90% time. That only holds while every plateau is
+ * longer than the sample period, otherwise the samples step over whole
+ * bits and the band samples of several edges are counted as one. The edges
+ * are then left untimed, with no rising or falling edge reported
+ */
+struct DCP_ADCProbe_t {
+    float VIH;                  //V, mean of the high plateau
+    float VIL;                  //V, mean of the low plateau
+    float rise;                 //s, mean 10%-90% time of the rising edges
+    float fall;                 //s, mean 90%-10% time of the falling edges
+    uint32_t rate;              //samples per second
+    uint32_t samples;
+    uint32_t rising;            //edges seen, 0 if they were not timed
+    uint32_t falling;
+    bool high;                  //plateaus found, a quiet bus only has the high one
+    bool low;
+};
+
+///////////////////////////////////////////////////////////////
+
+/*!
+ * @brief samples the line for windowMs, half to find the plateaus and half
+ * to time the edges
+ * @param plateauUs shortest plateau of the traffic, one delta of its speed
+ * @return false if the pin has no ADC channel or the ADC could not be set up
+ */
+bool ADCProbe(const gpio_num_t pin, const uint32_t windowMs, const float plateauUs, struct DCP_ADCProbe_t* ret);
+
+/*!
+ * @brief same as ADCProbe, for callers that have their own loop
+ *
+ * the ADC fills its buffer in the background, ADCProbeDrain must be called
+ * often enough that it does not overflow, lost samples only make the edge
+ * times less accurate
+ */
+bool ADCProbeStart(const gpio_num_t pin, const uint32_t windowMs, const float plateauUs);
+//processes the samples taken so far, waiting up to waitMs for more. Returns true once the window is complete
+bool ADCProbeDrain(const uint32_t waitMs);
+void ADCProbeStop(struct DCP_ADCProbe_t* ret);
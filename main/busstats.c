@@ -0,0 +1,98 @@
+#include "busstats.h"
+#include "framelog.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "sdkconfig.h"
+
+#include <string.h>
+
+static const char* TAG = "Bus stats";
+
+static struct DCP_BusStats_t stats;
+
+//open addressing table of the IDS -> IDD pairs seen on the bus
+//the full 256x256 matrix doesn't fit the RAM, the busy pairs of a bus do
+static struct DCP_TrafficPair_t pairs[CONFIG_DCP_STATS_PAIRS];
+
+///////////////////////////////////////////////////////////////
+
+static void s_CountPair(const uint8_t IDS, const uint8_t IDD){
+
+    const uint16_t key = IDS << 8 | IDD;
+    uint32_t slot = (key * 40503UL) % CONFIG_DCP_STATS_PAIRS;
+
+    for (int i = 0; i < CONFIG_DCP_STATS_PAIRS; ++i, slot = (slot + 1) % CONFIG_DCP_STATS_PAIRS){
+        if (pairs[slot].count == 0){
+            pairs[slot] = (struct DCP_TrafficPair_t){.IDS = IDS, .IDD = IDD, .count = 1};
+            return;
+        }
+
+        if (pairs[slot].IDS == IDS && pairs[slot].IDD == IDD){
+            pairs[slot].count++;
+            return;
+        }
+    }
+
+    stats.droppedPairs++;
+}
+
+void StatsReset(void){
+    memset(&stats, 0, sizeof stats);
+    memset(pairs, 0, sizeof pairs);
+}
+
+void StatsFrame(const struct DCP_Frame_t* frame){
+
+    stats.frames++;
+    stats.bytes += frame->size;
+    stats.busy += frame->end - frame->start;
+
+    for (uint32_t errors = frame->errors; errors; errors &= errors - 1){
+        stats.errors[__builtin_ctz(errors)]++;
+    }
+
+    //a node losing the arbitration stops mid frame
+    if (frame->size == 0 || frame->size < FrameExpectedSize(frame)){
+        stats.collisions++;
+    }
+
+    const int IDS = FrameIDS(frame);
+    const int IDD = FrameIDD(frame);
+
+    if (IDS >= 0 && IDD >= 0){
+        stats.sent[IDS]++;
+        stats.received[IDD]++;
+        s_CountPair(IDS, IDD);
+    }
+}
+
+void StatsElapsed(const uint64_t us){
+    stats.elapsed += us;
+}
+
+static bool s_OnStatsFrame(const struct DCP_Frame_t* frame, const uint32_t seq, void* ctx){
+    StatsFrame(frame);
+    LogFrame(frame);
+    return false;
+}
+
+void StatsMonitor(const gpio_num_t pin, const uint32_t timeoutMs){
+
+    const int64_t begin = esp_timer_get_time();
+    const uint32_t frames = stats.frames;
+
+    (void)CaptureListen(pin, timeoutMs, s_OnStatsFrame, NULL);
+
+    StatsElapsed(esp_timer_get_time() - begin);
+
+    ESP_LOGI(TAG, "monitored %lu frames", stats.frames - frames);
+}
+
+const struct DCP_BusStats_t* StatsGet(void){
+    return &stats;
+}
+
+const struct DCP_TrafficPair_t* StatsPairs(void){
+    return pairs;
+}
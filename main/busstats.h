@@ -0,0 +1,46 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "capture.h"
+
+///////////////////////////////////////////////////////////////
+
+/*!
+ * running statistics of a passively monitored bus
+ *
+ * everything is folded frame by frame, so the memory does not grow
+ * with the monitoring time
+ */
+struct DCP_BusStats_t {
+    uint64_t elapsed;           //observed time, in us
+    uint64_t busy;              //cycles inside frames
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t collisions;        //frames cut before their size, another node took over
+    uint32_t errors[32];        //frames flagging each DCP_Errors_e bit
+    uint32_t sent[256];         //L3 frames by IDS
+    uint32_t received[256];     //L3 frames by IDD
+    uint32_t droppedPairs;      //L3 frames whose IDS/IDD pair didn't fit the table
+};
+
+struct DCP_TrafficPair_t {
+    uint8_t IDS;
+    uint8_t IDD;
+    uint32_t count;             //0 for a free slot
+};
+
+void StatsReset(void);
+void StatsFrame(const struct DCP_Frame_t* frame);
+void StatsElapsed(const uint64_t us);
+
+/*!
+ * @brief monitors the bus for timeoutMs, folding every frame in the statistics
+ * and in the session log
+ */
+void StatsMonitor(const gpio_num_t pin, const uint32_t timeoutMs);
+
+const struct DCP_BusStats_t* StatsGet(void);
+//source -> destination counters, CONFIG_DCP_STATS_PAIRS slots, free slots have count 0
+const struct DCP_TrafficPair_t* StatsPairs(void);
@@ -0,0 +1,205 @@
+#include "capacity.h"
+#include "DCP_internal.h"
+#include "capture.h"
+#include "validator.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_private/esp_clk.h>
+
+#include <string.h>
+
+static const char* TAG = "Capacity";
+
+///////////////////////////////////////////////////////////////
+
+//the frames of the step in flight, the answers are not matched to one frame
+struct Ack_t {
+    uint8_t IDD;
+    bool echo;
+    uint32_t first;             //sequence numbers sent so far in the step
+    uint32_t next;
+    uint32_t acknowledged;
+};
+
+static bool s_OnAck(const struct DCP_Frame_t* frame, const uint32_t seq, void* ctx){
+    struct Ack_t* const ack = ctx;
+
+    if (FrameIDS(frame) != ack->IDD || frame->errors != ERROR_none) return false;
+
+    if (ack->echo){
+        //the data starts after type, SOH, IDS, IDD and COD
+        if (frame->size <= 10) return false;
+
+        const uint8_t* const data = &frame->data[5];
+        const uint32_t n = (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+
+        if (n - ack->first >= ack->next - ack->first) return false;
+    }
+
+    ack->acknowledged++;
+
+    //keeps listening until the next slot, a late answer still counts
+    return false;
+}
+
+//the rate of a step is paced in us, ticks are too coarse for it
+static void s_WaitUntil(const int64_t t){
+    const int64_t ahead = t - esp_timer_get_time();
+
+    if (ahead > 2000*portTICK_PERIOD_MS) vTaskDelay(pdMS_TO_TICKS(ahead/1000) - 1);
+
+    while (esp_timer_get_time() < t);
+}
+
+static void s_Step(const gpio_num_t pin, const struct DCP_CapacityTest_t* test, const uint32_t delays[4], uint32_t* seq, struct DCP_CapacityStep_t* step){
+
+    DCP_Data_t frame = {.message = &(struct DCP_Message_t){0}};
+
+    frame.message->type = 0;
+    frame.message->L3.IDS = test->IDS;
+    frame.message->L3.IDD = test->IDD;
+    frame.message->L3.COD = test->COD;
+    frame.message->L3.PAD = DCP_L3_PAD;
+
+    const int64_t intervalUs = 1e6 / step->rate;
+    const int64_t begin = esp_timer_get_time();
+
+    struct Ack_t ack = {.IDD = test->IDD, .echo = test->echo, .first = *seq, .next = *seq};
+
+    for (uint32_t k = 0; k < test->frames; ++k){
+        const int64_t slot = begin + k*intervalUs;
+
+        s_WaitUntil(slot);
+
+        const uint32_t n = (*seq)++;
+        frame.message->L3.data[0] = n >> 24;
+        frame.message->L3.data[1] = n >> 16;
+        frame.message->L3.data[2] = n >> 8;
+        frame.message->L3.data[3] = n;
+        DCPStampL3(&frame.message->L3);
+
+        //the DUT still talking over the slot is a sign it is not keeping up
+        if (DCPSendFrame(pin, delays, sizeof(struct DCP_Message_t), frame.data)){
+            step->collisions++;
+            continue;
+        }
+
+        step->sent++;
+        ack.next = *seq;
+
+        //the next frame goes out on its slot whether or not this one was answered,
+        //the answers of every frame in flight are taken in between
+        (void)CaptureAnswerUntil(pin, slot + intervalUs, s_OnAck, &ack);
+    }
+
+    const int64_t elapsed = esp_timer_get_time() - begin;
+    step->achieved = elapsed > 0? step->sent * 1e6f / elapsed: 0;
+
+    //one more interval for the answers to the last frames
+    (void)CaptureAnswerUntil(pin, esp_timer_get_time() + intervalUs, s_OnAck, &ack);
+
+    step->acknowledged = ack.acknowledged < step->sent? ack.acknowledged: step->sent;
+}
+
+struct Burst_t {
+    uint8_t IDD;
+    uint8_t expected;
+    uint32_t received;
+    uint32_t errors;
+    uint32_t bytes;
+    esp_cpu_cycle_count_t first;
+    esp_cpu_cycle_count_t last;
+};
+
+static bool s_OnBurst(const struct DCP_Frame_t* frame, const uint32_t seq, void* ctx){
+    struct Burst_t* const burst = ctx;
+
+    //the burst may be made of generic frames, which have no source
+    if (frame->data[0] == 0 && FrameIDS(frame) != burst->IDD) return false;
+
+    if (!burst->received) burst->first = frame->start;
+    burst->last = frame->end;
+    burst->received++;
+    burst->bytes += frame->size;
+    if (frame->errors != ERROR_none) burst->errors++;
+
+    return burst->received >= burst->expected;
+}
+
+static void s_Burst(const gpio_num_t pin, const struct DCP_CapacityTest_t* test, const uint32_t delays[4], struct DCP_CapacityReport_t* report){
+
+    DCP_Data_t frame = {.message = &(struct DCP_Message_t){0}};
+
+    frame.message->type = 0;
+    frame.message->L3.IDS = test->IDS;
+    frame.message->L3.IDD = test->IDD;
+    frame.message->L3.COD = test->burstCOD;
+    frame.message->L3.data[0] = test->burstFrames;
+    frame.message->L3.PAD = DCP_L3_PAD;
+    DCPStampL3(&frame.message->L3);
+
+    struct Burst_t burst = {.IDD = test->IDD, .expected = test->burstFrames};
+
+    //a busy bus gets a few more chances
+    for (int i = 0; i < 4; ++i){
+        if (!DCPSendFrame(pin, delays, sizeof(struct DCP_Message_t), frame.data)){
+            (void)CaptureAnswer(pin, test->burstMs, s_OnBurst, &burst);
+            break;
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    report->burstReceived = burst.received;
+    report->burstErrors = burst.errors;
+
+    const double seconds = (burst.last - burst.first) / (double)esp_clk_cpu_freq();
+
+    if (burst.received > 1 && seconds > 0){
+        report->burstRate = burst.received / seconds;
+        report->burstBytes = burst.bytes / seconds;
+    }
+}
+
+void CapacityTest(const gpio_num_t pin, const struct DCP_CapacityTest_t* test, struct DCP_CapacityReport_t* report){
+
+    memset(report, 0, sizeof(*report));
+
+    uint32_t delays[4];
+    DCPFrameDelays(TargetSpeed(), true, NULL, delays);
+
+    const TickType_t begin = xTaskGetTickCount();
+    uint32_t seq = 0;
+
+    for (float rate = test->startRate; report->steps < CAPACITY_STEPS && rate <= test->maxRate; rate *= test->factor){
+        struct DCP_CapacityStep_t* const step = &report->step[report->steps++];
+
+        step->rate = rate;
+        s_Step(pin, test, delays, &seq, step);
+
+        ESP_LOGI(TAG, "%.0f/s asked, %.0f/s sent, %lu/%lu acknowledged, %lu collisions", step->rate, step->achieved,
+                step->acknowledged, step->sent, step->collisions);
+
+        if (!step->sent || step->acknowledged < test->threshold * (step->sent + step->collisions)){
+            report->saturated = true;
+            break;
+        }
+
+        report->capacity = step->achieved;
+
+        //lets the idle task feed the watchdog
+        vTaskDelay(1);
+    }
+
+    if (test->burst){
+        s_Burst(pin, test, delays, report);
+
+        ESP_LOGI(TAG, "burst of %lu/%u frames, %.0f frames/s", report->burstReceived, test->burstFrames, report->burstRate);
+    }
+
+    report->durationMs = pdTICKS_TO_MS(xTaskGetTickCount() - begin);
+}
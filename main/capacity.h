@@ -0,0 +1,68 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <driver/gpio.h>
+
+#include "DCP.h"
+
+///////////////////////////////////////////////////////////////
+
+#define CAPACITY_STEPS 16
+
+/*!
+ * @brief load test of the DUT
+ *
+ * the validator sends L3 frames with COD to the DUT at a rate growing by
+ * factor each step, from startRate up to maxRate frames per second. The
+ * first four data bytes of each frame are its sequence number. The frames
+ * go out on their slots without waiting for the answers, every frame from
+ * the DUT address without errors is an acknowledge and, with echo, only if
+ * it carries the sequence number of a frame of the step. The load stops at
+ * the first step with less than threshold of the frames acknowledged.
+ *
+ * with burstCOD the DUT is then asked, with the count as the first data
+ * byte, for burstFrames frames back to back and its transmit rate is timed
+ */
+struct DCP_CapacityTest_t {
+    uint8_t IDS;                //of the validator
+    uint8_t IDD;                //of the DUT
+    uint8_t COD;
+    bool echo;
+    float startRate;
+    float factor;
+    float maxRate;
+    uint32_t frames;            //per step
+    float threshold;            //fraction of acknowledged frames to keep up
+    bool burst;
+    uint8_t burstCOD;
+    uint8_t burstFrames;
+    uint32_t burstMs;           //wait for the whole burst
+};
+
+struct DCP_CapacityStep_t {
+    float rate;                 //asked for
+    float achieved;             //frames sent per second
+    uint32_t sent;
+    uint32_t acknowledged;
+    uint32_t collisions;        //frames that found the bus taken, not sent
+};
+
+struct DCP_CapacityReport_t {
+    uint8_t steps;
+    struct DCP_CapacityStep_t step[CAPACITY_STEPS];
+    float capacity;             //achieved rate of the last step kept up with
+    bool saturated;             //false if the DUT kept up to maxRate
+
+    uint32_t burstReceived;
+    uint32_t burstErrors;
+    float burstRate;            //frames per second
+    float burstBytes;           //bytes per second
+    uint32_t durationMs;
+};
+
+///////////////////////////////////////////////////////////////
+
+//the target bus must be set up, the frames go out at its speed
+void CapacityTest(const gpio_num_t pin, const struct DCP_CapacityTest_t* test, struct DCP_CapacityReport_t* report);
@@ -0,0 +1,478 @@
+#include "capture.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/portmacro.h>
+
+#include <driver/gpio.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "esp_cpu.h"
+#include "sdkconfig.h"
+
+#include <assert.h>
+#include <string.h>
+
+static const char* TAG = "Capture";
+
+///////////////////////////////////////////////////////////////
+
+static void s_StartFrame(struct DCP_Decoder_t* dec, const uint32_t seq, const esp_cpu_cycle_count_t t){
+    struct DCP_Frame_t* const frame = &dec->frame;
+
+    frame->start = t;
+    frame->end = t;
+    frame->firstEdge = seq;
+    frame->edges = 1;
+    frame->size = 0;
+    frame->errors = ERROR_none;
+    frame->sync = 0;
+    frame->bitSync_high = 0;
+    frame->bitSync_low = 0;
+    frame->bit0 = 0;
+    frame->bit1 = 0;
+
+    dec->bits = 0;
+    dec->state = DEC_SYNC;
+}
+
+static void s_CheckSync(struct DCP_Decoder_t* dec, const esp_cpu_cycle_count_t dur){
+    dec->frame.sync = dur;
+
+    if (dur > 100*dec->limits[1]){
+        dec->frame.errors |= ERROR_sync_inf;
+    }
+
+    if (dur > dec->syncDeltas*dec->limits[1]){
+        dec->frame.errors |= ERROR_sync_tooLong;
+    }else if (dur < dec->syncDeltas*dec->limits[0]){
+        dec->frame.errors |= ERROR_sync_tooShort;
+    }
+
+    dec->state = DEC_BS_HIGH;
+}
+
+static void s_Finish(struct DCP_Decoder_t* dec){
+    struct DCP_Frame_t* const frame = &dec->frame;
+
+    frame->size = dec->bits >> 3;
+
+    if (frame->size == 0 || (dec->bits & 0x7) || frame->size != FrameExpectedSize(frame)){
+        frame->errors |= ERROR_invalidSize;
+    }
+
+    if (frame->size >= FrameExpectedSize(frame)){
+        frame->errors |= frame->data[0]? ValidGeneric(frame->data): ValidL3(frame->data);
+    }
+
+    dec->state = DEC_IDLE;
+}
+
+//the previous frame was handed out while the next one had already started
+static void s_Resume(struct DCP_Decoder_t* dec){
+    if (!dec->pending) return;
+
+    dec->pending = false;
+    s_StartFrame(dec, dec->next, dec->nextStart);
+
+    if (dec->nextSync){
+        dec->frame.edges = 2;
+        dec->frame.end = dec->nextStart + dec->nextSync;
+        s_CheckSync(dec, dec->nextSync);
+    }
+}
+
+void DecoderReset(struct DCP_Decoder_t* dec, const esp_cpu_cycle_count_t limits[2], const uint8_t syncDeltas){
+    dec->state = DEC_IDLE;
+    dec->limits[0] = limits[0];
+    dec->limits[1] = limits[1];
+    dec->syncDeltas = syncDeltas;
+    dec->last = 0;
+    dec->bits = 0;
+    dec->pending = false;
+}
+
+bool DecoderEdge(struct DCP_Decoder_t* dec, const uint32_t seq, const int level, const esp_cpu_cycle_count_t t){
+
+    const esp_cpu_cycle_count_t dur = t - dec->last;
+    struct DCP_Frame_t* const frame = &dec->frame;
+
+    s_Resume(dec);
+    dec->last = t;
+
+    switch(dec->state){
+        case DEC_IDLE:
+            if (level == 0){
+                s_StartFrame(dec, seq, t);
+            }
+            return false;
+        case DEC_SYNC:
+            s_CheckSync(dec, dur);
+            break;
+        case DEC_BS_HIGH:
+            frame->bitSync_high = dur;
+
+            if (dur > 7.5*dec->limits[1]){
+                frame->errors |= ERROR_bitSync_tooLong;
+            }else if (dur < 7.5*dec->limits[0]){
+                frame->errors |= ERROR_bitSync_tooShort;
+            }
+
+            dec->state = DEC_BS_LOW;
+            break;
+        case DEC_BS_LOW:
+            frame->bitSync_low = dur;
+
+            if (dur > 10*dec->limits[1]){
+                frame->errors |= ERROR_bitSync_invalidLow;
+            }
+
+            dec->state = DEC_BIT_HIGH;
+            break;
+        case DEC_BIT_HIGH: {
+            const uint32_t byte = dec->bits >> 3;
+            const uint8_t bit = dec->bits & 0x7;
+
+            if (bit == 0){
+                frame->data[byte] = 0;
+            }
+
+            if (dur <= dec->limits[1]){
+                frame->bit0 = dur;
+            }else {
+                frame->bit1 = dur;
+                frame->data[byte] |= 0x80 >> bit;
+            }
+
+            dec->bits++;
+            dec->state = DEC_BIT_LOW;
+            break;
+        }
+        case DEC_BIT_LOW:
+            //the type byte tells how long the frame is, anything after it is extra data
+            dec->state = dec->bits >= 8UL*FrameExpectedSize(frame)? DEC_TRAIL: DEC_BIT_HIGH;
+            break;
+        case DEC_TRAIL:
+            //either extra data or the sync of the next frame, the low time tells
+            dec->next = seq;
+            dec->nextStart = t;
+            dec->state = DEC_TRAIL_LOW;
+            return false;
+        case DEC_TRAIL_LOW:
+            if (dur > 10*dec->limits[1]){
+                s_Finish(dec);
+
+                dec->pending = true;
+                dec->nextSync = dur;
+                return true;
+            }
+
+            //a short low is extra data, the next long one is still a sync
+            frame->edges++;
+            frame->errors |= ERROR_invalidSize;
+            dec->state = DEC_TRAIL;
+            break;
+    }
+
+    frame->edges++;
+    frame->end = t;
+
+    return false;
+}
+
+bool DecoderIdle(struct DCP_Decoder_t* dec, const esp_cpu_cycle_count_t now){
+
+    const esp_cpu_cycle_count_t dur = now - dec->last;
+
+    s_Resume(dec);
+
+    switch(dec->state){
+        case DEC_SYNC:
+            if (dur > 100*dec->limits[1]){
+                dec->frame.errors |= ERROR_sync_inf;
+            }
+            return false;
+        case DEC_BS_HIGH:
+            if (dur > 10*dec->limits[1]){
+                dec->frame.errors |= ERROR_bitSync_inf;
+                s_Finish(dec);
+                return true;
+            }
+            return false;
+        case DEC_BIT_HIGH:
+        case DEC_TRAIL:
+            if (dur > 4*dec->limits[1]){
+                s_Finish(dec);
+                return true;
+            }
+            return false;
+        case DEC_TRAIL_LOW:
+            //the next frame's sync is still going
+            if (dur > 10*dec->limits[1]){
+                s_Finish(dec);
+
+                dec->pending = true;
+                dec->nextSync = 0;
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+uint16_t FrameExpectedSize(const struct DCP_Frame_t* frame){
+    return frame->data[0]? frame->data[0]: sizeof(struct DCP_Message_L3_t)+1;
+}
+
+int FrameIDS(const struct DCP_Frame_t* frame){
+    return (frame->size > 2 && frame->data[0] == 0)? frame->data[2]: -1;
+}
+
+int FrameIDD(const struct DCP_Frame_t* frame){
+    return (frame->size > 3 && frame->data[0] == 0)? frame->data[3]: -1;
+}
+
+int FrameCOD(const struct DCP_Frame_t* frame){
+    return (frame->size > 4 && frame->data[0] == 0)? frame->data[4]: -1;
+}
+
+///////////////////////////////////////////////////////////////
+
+static esp_cpu_cycle_count_t edgeRing[CONFIG_DCP_CAPTURE_EDGES];
+static struct DCP_Frame_t frameRing[CONFIG_DCP_CAPTURE_FRAMES];
+static struct DCP_Decoder_t decoder;
+static struct DCP_Capture_t window;
+static uint32_t edgeSeq;
+static uint32_t frameSeq;
+
+static bool s_Matches(const struct DCP_Trigger_t* trigger, const struct DCP_Frame_t* frame){
+
+    if ((trigger->fields & TRIGGER_IDS) && FrameIDS(frame) != trigger->IDS) return false;
+    if ((trigger->fields & TRIGGER_IDD) && FrameIDD(frame) != trigger->IDD) return false;
+    if ((trigger->fields & TRIGGER_COD) && FrameCOD(frame) != trigger->COD) return false;
+    if ((trigger->fields & TRIGGER_type) && (frame->size == 0 || frame->data[0] != trigger->type)) return false;
+
+    if (trigger->fields & TRIGGER_error){
+        const uint32_t mask = trigger->errorMask? trigger->errorMask: ~0UL;
+        if ((frame->errors & mask) == 0) return false;
+    }
+
+    return true;
+}
+
+struct SpeedDetect_t {
+    uint8_t edges;
+    uint32_t seq;                   //of the sync falling edge
+    esp_cpu_cycle_count_t t[3];     //sync falling, sync rising, bit sync falling
+};
+
+//collects the sync and bit sync of the first frame, true once the speed is known
+static bool s_Detect(struct SpeedDetect_t* det, const uint32_t seq, const int level, const esp_cpu_cycle_count_t t){
+
+    //only a falling edge can start a sync
+    if (det->edges == 0 && level != 0) return false;
+    if (det->edges == 0) det->seq = seq;
+
+    det->t[det->edges++] = t;
+    if (det->edges < 3) return false;
+
+    enum DCP_Speed_e speed;
+    if (DetectSpeed(det->t[1] - det->t[0], det->t[2] - det->t[1], &speed)){
+        SetTargetSpeed(speed);
+        ESP_LOGI(TAG, "detected speed class %d", speed);
+        return true;
+    }
+
+    //not a sync, the last falling edge may start one
+    det->seq = seq;
+    det->t[0] = t;
+    det->edges = 1;
+
+    return false;
+}
+
+//end is an esp_timer time, the ticks are too coarse for the short answer windows
+static bool s_Listen(const gpio_num_t pin, const int64_t end, const bool waitIdle, const esp_cpu_cycle_count_t* fall,
+        const CaptureCallback_t onFrame, void* ctx){
+
+    //with the speed unknown, the idle wait must hold for the slowest class
+    bool detecting = TargetAutoSpeed();
+    struct SpeedDetect_t det = {0};
+
+    const struct DCP_Timing_t* const configParam = detecting? DCPSpeedTiming(SLOW): TargetTiming();
+    assert(configParam->limits[0] != 0 && configParam->limits[1] != 0);
+
+    gpio_set_direction(pin, GPIO_MODE_INPUT);
+    DecoderReset(&decoder, configParam->limits, TargetSyncDeltas());
+
+    unsigned n = 0;
+
+    edgeSeq = 0;
+    frameSeq = 0;
+
+    //only start on an idle bus, so the first edge is a sync
+    //wait for at least 15delta of idle
+    for (esp_cpu_cycle_count_t idle = esp_cpu_get_cycle_count(); waitIdle && esp_cpu_get_cycle_count() - idle < 15*configParam->limits[1]; ++n){
+        if (gpio_get_level(pin) == 0) idle = esp_cpu_get_cycle_count();
+
+        if ((n & 0xFF) == 0 && esp_timer_get_time() > end) return false;
+    }
+
+    int level = 1;
+    decoder.last = esp_cpu_get_cycle_count();
+
+    //the caller already saw the sync falling edge
+    if (fall){
+        level = 0;
+        edgeRing[edgeSeq % CONFIG_DCP_CAPTURE_EDGES] = *fall;
+
+        if (detecting){
+            (void)s_Detect(&det, edgeSeq++, 0, *fall);
+        }else{
+            (void)DecoderEdge(&decoder, edgeSeq++, 0, *fall);
+        }
+    }
+
+    for (;; ++n){
+        const int l = gpio_get_level(pin);
+        const esp_cpu_cycle_count_t now = esp_cpu_get_cycle_count();
+        bool complete = false;
+
+        if (l != level){
+            level = l;
+
+            complete = DecoderIdle(&decoder, now);
+            if (complete){
+                frameRing[frameSeq % CONFIG_DCP_CAPTURE_FRAMES] = decoder.frame;
+            }
+
+            edgeRing[edgeSeq % CONFIG_DCP_CAPTURE_EDGES] = now;
+
+            if (detecting){
+                if (s_Detect(&det, edgeSeq++, l, now)){
+                    detecting = false;
+
+                    //the decoder picks the frame up from its sync
+                    DecoderReset(&decoder, TargetTiming()->limits, TargetSyncDeltas());
+                    for (int i = 0; i < 3; ++i){
+                        (void)DecoderEdge(&decoder, det.seq + i, i & 0x1, det.t[i]);
+                    }
+                }
+                continue;
+            }
+
+            //a frame can't end on the same edge that closed the previous one
+            if (DecoderEdge(&decoder, edgeSeq++, l, now)){
+                assert(!complete);
+                complete = true;
+                frameRing[frameSeq % CONFIG_DCP_CAPTURE_FRAMES] = decoder.frame;
+            }
+        }else if ((n & 0x3F) == 0){
+            complete = DecoderIdle(&decoder, now);
+            if (complete){
+                frameRing[frameSeq % CONFIG_DCP_CAPTURE_FRAMES] = decoder.frame;
+            }
+
+            if ((n & 0xFFF) == 0 && esp_timer_get_time() > end) return false;
+        }
+
+        if (!complete) continue;
+
+        const uint32_t seq = frameSeq++;
+        if (onFrame(&frameRing[seq % CONFIG_DCP_CAPTURE_FRAMES], seq, ctx)) return true;
+    }
+}
+
+static int64_t s_End(const uint32_t timeoutMs){
+    return esp_timer_get_time() + (int64_t)timeoutMs*1000;
+}
+
+bool CaptureListen(const gpio_num_t pin, const uint32_t timeoutMs, const CaptureCallback_t onFrame, void* ctx){
+    return s_Listen(pin, s_End(timeoutMs), true, NULL, onFrame, ctx);
+}
+
+bool CaptureAnswer(const gpio_num_t pin, const uint32_t timeoutMs, const CaptureCallback_t onFrame, void* ctx){
+    return s_Listen(pin, s_End(timeoutMs), false, NULL, onFrame, ctx);
+}
+
+bool CaptureAnswerUntil(const gpio_num_t pin, const int64_t endUs, const CaptureCallback_t onFrame, void* ctx){
+    return s_Listen(pin, endUs, false, NULL, onFrame, ctx);
+}
+
+bool CaptureFrom(const gpio_num_t pin, const esp_cpu_cycle_count_t fall, const uint32_t timeoutMs, const CaptureCallback_t onFrame, void* ctx){
+    return s_Listen(pin, s_End(timeoutMs), false, &fall, onFrame, ctx);
+}
+
+struct TriggerState_t {
+    const struct DCP_Trigger_t* trigger;
+    uint32_t triggerSeq;
+};
+
+static bool s_OnTriggerFrame(const struct DCP_Frame_t* frame, const uint32_t seq, void* ctx){
+    struct TriggerState_t* const state = ctx;
+
+    if (!window.triggered && s_Matches(state->trigger, frame)){
+        window.triggered = true;
+        state->triggerSeq = seq;
+        ESP_LOGD(TAG, "triggered on frame %lu", seq);
+    }
+
+    return window.triggered && seq - state->triggerSeq >= state->trigger->postFrames;
+}
+
+bool CaptureRun(const gpio_num_t pin, const struct DCP_Trigger_t* trigger, const uint32_t timeoutMs){
+
+    window = (struct DCP_Capture_t){0};
+
+    if (trigger->preFrames + trigger->postFrames + 1 > CONFIG_DCP_CAPTURE_FRAMES){
+        ESP_LOGE(TAG, "trigger window of %u frames does not fit the ring", trigger->preFrames + trigger->postFrames + 1);
+        return false;
+    }
+
+    struct TriggerState_t state = {.trigger = trigger};
+    (void)CaptureListen(pin, timeoutMs, s_OnTriggerFrame, &state);
+
+    const uint32_t triggerSeq = state.triggerSeq;
+
+    if (!window.triggered){
+        ESP_LOGI(TAG, "no trigger after %lu frames", frameSeq);
+        return false;
+    }
+
+    //only the trigger window is kept
+    window.firstFrame = triggerSeq > trigger->preFrames? triggerSeq - trigger->preFrames: 0;
+    window.frames = frameSeq - window.firstFrame;
+    window.trigger = triggerSeq - window.firstFrame;
+
+    const struct DCP_Frame_t* const last = CaptureFrame(window.frames - 1);
+    const uint32_t lastEdge = last->firstEdge + last->edges;
+
+    window.firstEdge = CaptureFrame(0)->firstEdge;
+
+    //the oldest edges may already be overwritten, keep the falling/rising parity
+    if (edgeSeq - window.firstEdge > CONFIG_DCP_CAPTURE_EDGES){
+        window.firstEdge = (edgeSeq - CONFIG_DCP_CAPTURE_EDGES + 1) & ~1UL;
+        ESP_LOGW(TAG, "edge ring overrun, oldest edges lost");
+    }
+
+    window.edges = lastEdge - window.firstEdge;
+
+    ESP_LOGI(TAG, "kept %u frames and %lu edges", window.frames, window.edges);
+
+    return true;
+}
+
+const struct DCP_Capture_t* CaptureGet(void){
+    return &window;
+}
+
+const struct DCP_Frame_t* CaptureFrame(const uint16_t index){
+    assert(index < window.frames);
+    return &frameRing[(window.firstFrame + index) % CONFIG_DCP_CAPTURE_FRAMES];
+}
+
+esp_cpu_cycle_count_t CaptureEdge(const uint32_t index){
+    assert(index < window.edges);
+    return edgeRing[(window.firstEdge + index) % CONFIG_DCP_CAPTURE_EDGES];
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <driver/gpio.h>
+#include "esp_cpu.h"
+
+#include "DCP.h"
+#include "validator.h"
+
+///////////////////////////////////////////////////////////////
+
+//biggest frame the decoder can hold, the type byte limits it
+#define CAPTURE_FRAME_MAX 0xFF
+
+struct DCP_Frame_t {
+    esp_cpu_cycle_count_t start;    //falling edge of the sync
+    esp_cpu_cycle_count_t end;      //last edge of the frame
+    uint32_t firstEdge;             //sequence number of the sync falling edge
+    uint32_t edges;                 //edges belonging to this frame
+    uint16_t size;                  //bytes received
+    uint8_t data[CAPTURE_FRAME_MAX];
+    enum DCP_Errors_e errors;
+
+    //raw timings, in cycles
+    esp_cpu_cycle_count_t sync;
+    esp_cpu_cycle_count_t bitSync_high;
+    esp_cpu_cycle_count_t bitSync_low;
+    esp_cpu_cycle_count_t bit0;
+    esp_cpu_cycle_count_t bit1;
+};
+
+/*!
+ * @brief streaming frame decoder
+ *
+ * it works on edge timestamps only, so anything able to produce the
+ * edges of a waveform (the GPIO poller or a software model) can feed it
+ */
+struct DCP_Decoder_t {
+    enum {
+        DEC_IDLE, DEC_SYNC, DEC_BS_HIGH, DEC_BS_LOW, DEC_BIT_HIGH, DEC_BIT_LOW,
+        DEC_TRAIL, DEC_TRAIL_LOW
+    } state;
+    esp_cpu_cycle_count_t limits[2];
+    uint8_t syncDeltas;     //25 for a controller, 50 for any other node
+    esp_cpu_cycle_count_t last;
+    uint32_t bits;
+
+    //a frame may start before the previous one is handed out
+    bool pending;
+    uint32_t next;
+    esp_cpu_cycle_count_t nextStart;
+    esp_cpu_cycle_count_t nextSync;
+
+    struct DCP_Frame_t frame;
+};
+
+void DecoderReset(struct DCP_Decoder_t* dec, const esp_cpu_cycle_count_t limits[2], const uint8_t syncDeltas);
+//feeds an edge, level is the bus level after it. Returns true when dec->frame is complete
+//DecoderIdle must be called with the same timestamp first, so a frame ended by silence is closed
+bool DecoderEdge(struct DCP_Decoder_t* dec, const uint32_t seq, const int level, const esp_cpu_cycle_count_t t);
+//checks for an ended frame while the bus is quiet. Returns true when dec->frame is complete
+bool DecoderIdle(struct DCP_Decoder_t* dec, const esp_cpu_cycle_count_t now);
+
+//size announced by the type byte, the type byte included
+uint16_t FrameExpectedSize(const struct DCP_Frame_t* frame);
+
+//L3 field accessors, -1 if the frame is not L3
+int FrameIDS(const struct DCP_Frame_t* frame);
+int FrameIDD(const struct DCP_Frame_t* frame);
+int FrameCOD(const struct DCP_Frame_t* frame);
+
+///////////////////////////////////////////////////////////////
+
+enum Trigger_e {
+    TRIGGER_any     = 0,
+    TRIGGER_IDS     = 1,
+    TRIGGER_IDD     = 1 << 1,
+    TRIGGER_COD     = 1 << 2,
+    TRIGGER_type    = 1 << 3,
+    TRIGGER_error   = 1 << 4
+};
+
+struct DCP_Trigger_t {
+    unsigned fields;        //Trigger_e mask, every selected field must match
+    uint8_t IDS;
+    uint8_t IDD;
+    uint8_t COD;
+    uint8_t type;
+    uint32_t errorMask;     //DCP_Errors_e that fire the trigger, 0 for any
+    uint16_t preFrames;     //frames kept before the trigger
+    uint16_t postFrames;    //frames kept after the trigger
+};
+
+struct DCP_Capture_t {
+    bool triggered;
+    uint32_t firstFrame;    //sequence number of the first kept frame
+    uint16_t frames;        //kept frames
+    uint16_t trigger;       //index of the trigger frame inside the window
+    uint32_t firstEdge;     //sequence number of the first kept edge
+    uint32_t edges;         //kept edges, even sequence numbers are falling edges
+};
+
+//called for every decoded frame, returning true stops the capture
+typedef bool (*CaptureCallback_t)(const struct DCP_Frame_t* frame, const uint32_t seq, void* ctx);
+
+/*!
+ * @brief samples the bus, feeding the rings and calling onFrame for each decoded frame
+ * @return true if onFrame stopped the capture, false on timeout
+ *
+ * the timeouts are kept in us with esp_timer, a few ms are not rounded to the tick
+ */
+bool CaptureListen(const gpio_num_t pin, const uint32_t timeoutMs, const CaptureCallback_t onFrame, void* ctx);
+
+//CaptureListen without the idle wait, for the answer to a frame the validator just sent
+bool CaptureAnswer(const gpio_num_t pin, const uint32_t timeoutMs, const CaptureCallback_t onFrame, void* ctx);
+//CaptureAnswer up to the esp_timer time endUs, for windows shorter than a tick
+bool CaptureAnswerUntil(const gpio_num_t pin, const int64_t endUs, const CaptureCallback_t onFrame, void* ctx);
+//CaptureAnswer for a frame whose sync falling edge was seen at fall, same cycle counter
+bool CaptureFrom(const gpio_num_t pin, const esp_cpu_cycle_count_t fall, const uint32_t timeoutMs, const CaptureCallback_t onFrame, void* ctx);
+
+/*!
+ * @brief runs the capture ring until the trigger window is complete
+ * @param timeoutMs = time to give up waiting for the trigger
+ *
+ * the bus is sampled continuously, only the last CONFIG_DCP_CAPTURE_FRAMES
+ * frames and CONFIG_DCP_CAPTURE_EDGES edges are kept. The window stays
+ * available through CaptureGet until the next run
+ */
+bool CaptureRun(const gpio_num_t pin, const struct DCP_Trigger_t* trigger, const uint32_t timeoutMs);
+
+const struct DCP_Capture_t* CaptureGet(void);
+const struct DCP_Frame_t* CaptureFrame(const uint16_t index);
+esp_cpu_cycle_count_t CaptureEdge(const uint32_t index);
@@ -0,0 +1,225 @@
+#include "dutmodel.h"
+#include "capture.h"
+#include "rules.h"
+#include "validator.h"
+
+#include <esp_private/esp_clk.h>
+#include <esp_log.h>
+#include "esp_cpu.h"
+
+#include <string.h>
+
+static const char* TAG = "DUTModel";
+
+///////////////////////////////////////////////////////////////
+
+static uint32_t s_Random(uint32_t* state){
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+//interval of the given length in delta, jittered
+static esp_cpu_cycle_count_t s_Interval(const struct DCP_DUTModel_t* model, uint32_t* state, const float deltas){
+    const float base = deltas * model->delta;
+    const float spread = (s_Random(state) / 4294967295.f) * 2 - 1;
+
+    return base + base * model->jitter * spread;
+}
+
+static uint8_t s_BuildFrame(const struct DCP_DUTModel_t* model, uint32_t* state, uint8_t data[]){
+
+    DCP_Data_t frame = {.data = data};
+
+    frame.message->type = 0;
+    frame.message->L3.IDS = model->addr;
+    frame.message->L3.IDD = s_Random(state);
+    frame.message->L3.COD = s_Random(state);
+
+    for (int i = 0; i < sizeof(frame.message->L3.data); ++i){
+        frame.message->L3.data[i] = s_Random(state);
+    }
+    frame.message->L3.PAD = DCP_L3_PAD;
+
+    DCPStampL3(&frame.message->L3);
+
+    if (model->faults & FAULT_badSOH) frame.message->L3.SOH ^= 0x80;
+    if (model->faults & FAULT_badIDS) frame.message->L3.IDS ^= 0x01;
+    if (model->faults & FAULT_badPAD) frame.message->L3.PAD ^= 0x10;
+
+    //a broken field must not break the CRC too
+    frame.message->L3.CRC = DCPCRC8(&frame.message->L3.SOH, sizeof(struct DCP_Message_L3_t)-1);
+
+    if (model->faults & FAULT_badCRC) frame.message->L3.CRC ^= 0x01;
+
+    uint8_t size = sizeof(struct DCP_Message_L3_t)+1;
+
+    if (model->faults & FAULT_truncated){
+        size -= 3;
+    }else if (model->faults & FAULT_extraByte){
+        data[size++] = s_Random(state);
+    }
+
+    return size;
+}
+
+uint32_t DUTWaveform(const struct DCP_DUTModel_t* model, esp_cpu_cycle_count_t edges[DUT_MAX_EDGES]){
+
+    uint32_t state = model->seed? model->seed: 1;
+    uint8_t data[sizeof(struct DCP_Message_L3_t)+2];
+    const uint8_t size = s_BuildFrame(model, &state, data);
+
+    esp_cpu_cycle_count_t t = 0;
+    uint32_t n = 0;
+
+    edges[n++] = t;
+    if (model->faults & FAULT_stuckLow) return n;
+
+    float sync = 25;
+    if (model->faults & FAULT_syncShort) sync = 22;
+    if (model->faults & FAULT_syncLong) sync = 28;
+
+    edges[n++] = t += s_Interval(model, &state, sync);
+    if (model->faults & FAULT_bitSyncStuck) return n;
+
+    float bitSync = 7.5;
+    if (model->faults & FAULT_bitSyncShort) bitSync = 6.5;
+    if (model->faults & FAULT_bitSyncLong) bitSync = 8.5;
+
+    edges[n++] = t += s_Interval(model, &state, bitSync);
+    edges[n++] = t += s_Interval(model, &state, (model->faults & FAULT_bitSyncLowLong)? 11: 7.5);
+
+    // if bit == 0: 1 delta high, 1 delta low
+    // else: 2 delta high, 1 delta low
+    for (int i = 0; i < 8*size; ++i){
+        const bool bit = (data[i >> 3] >> (7 - (i & 0x7))) & 0x1;
+
+        edges[n++] = t += s_Interval(model, &state, bit? 2: 1);
+        edges[n++] = t += s_Interval(model, &state, 1);
+    }
+
+    return n;
+}
+
+uint32_t DUTExpectedErrors(const uint32_t faults){
+
+    if (faults & FAULT_stuckLow) return ERROR_sync_inf;
+
+    uint32_t errors = ERROR_none;
+
+    if (faults & FAULT_syncShort) errors |= ERROR_sync_tooShort;
+    if (faults & FAULT_syncLong) errors |= ERROR_sync_tooLong;
+
+    if (faults & FAULT_bitSyncStuck) return errors | ERROR_bitSync_inf | ERROR_invalidSize;
+
+    if (faults & FAULT_bitSyncShort) errors |= ERROR_bitSync_tooShort;
+    if (faults & FAULT_bitSyncLong) errors |= ERROR_bitSync_tooLong;
+    if (faults & FAULT_bitSyncLowLong) errors |= ERROR_bitSync_invalidLow;
+
+    //the frame content is only checked when it is all there
+    if (faults & FAULT_truncated) return errors | ERROR_invalidSize;
+    if (faults & FAULT_extraByte) errors |= ERROR_invalidSize;
+
+    if (faults & FAULT_badSOH) errors |= ERROR_message_invalidL3_header;
+    if (faults & FAULT_badIDS) errors |= ERROR_message_invalidL3_sID;
+    if (faults & FAULT_badPAD) errors |= ERROR_message_invalidL3_padding;
+    if (faults & FAULT_badCRC) errors |= ERROR_message_invalidL3_CRC;
+
+    return errors;
+}
+
+///////////////////////////////////////////////////////////////
+
+static struct DCP_Decoder_t decoder;
+static esp_cpu_cycle_count_t waveform[DUT_MAX_EDGES];
+
+//errors reported by the decoder for the waveform
+static uint32_t s_Decode(const esp_cpu_cycle_count_t limits[2], const uint32_t edges){
+
+    //the model sends a controller sync
+    DecoderReset(&decoder, limits, 25);
+
+    for (uint32_t i = 0; i < edges; ++i){
+        if (DecoderIdle(&decoder, waveform[i]) || DecoderEdge(&decoder, i, i & 0x1, waveform[i])){
+            return decoder.frame.errors;
+        }
+    }
+
+    //trailing idle, long enough for every timeout. If the line never comes back
+    //the frame stays open and, as in the validator, the errors so far are reported
+    DecoderIdle(&decoder, waveform[edges-1] + 110*limits[1]);
+
+    return decoder.frame.errors;
+}
+
+void DUTSelfTest(const uint32_t seed, struct DCP_SelfTest_t* report){
+
+    //faults of the same group exclude each other
+    static const uint32_t syncFaults[] = {FAULT_none, FAULT_syncShort, FAULT_syncLong, FAULT_stuckLow};
+    static const uint32_t bitSyncFaults[] = {FAULT_none, FAULT_bitSyncShort, FAULT_bitSyncLong, FAULT_bitSyncStuck};
+    static const uint32_t lowFaults[] = {FAULT_none, FAULT_bitSyncLowLong};
+    static const uint32_t sizeFaults[] = {FAULT_none, FAULT_truncated, FAULT_extraByte};
+    static const uint32_t contentFaults[] = {FAULT_badSOH, FAULT_badIDS, FAULT_badPAD, FAULT_badCRC};
+
+    memset(report, 0, sizeof(*report));
+
+    //the built in rules only, restored with the DUT address once done
+    const uint8_t addr = 0x2A;
+    const uint8_t target = TargetAddress();
+    SetTargetAddress(addr);
+    RulesSuspend(true);
+
+    const uint32_t mhz = esp_clk_cpu_freq()/1000000;
+    uint32_t state = seed? seed: 1;
+
+    const esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+
+    for (enum DCP_Speed_e speed = SLOW; speed <= ULTRA; ++speed){
+
+        const struct DCP_Timing_t* const timing = DCPSpeedTiming(speed);
+
+        struct DCP_DUTModel_t model = {
+            .delta = timing->delta*mhz,
+            .jitter = timing->moe/timing->delta/2,      //half the margin of error
+            .addr = addr
+        };
+
+        for (int a = 0; a < sizeof(syncFaults)/sizeof(syncFaults[0]); ++a)
+        for (int b = 0; b < sizeof(bitSyncFaults)/sizeof(bitSyncFaults[0]); ++b)
+        for (int c = 0; c < sizeof(lowFaults)/sizeof(lowFaults[0]); ++c)
+        for (int d = 0; d < sizeof(sizeFaults)/sizeof(sizeFaults[0]); ++d)
+        for (uint32_t content = 0; content < 1U << 4; ++content){
+
+            model.faults = syncFaults[a] | bitSyncFaults[b] | lowFaults[c] | sizeFaults[d];
+            for (int i = 0; i < 4; ++i){
+                if (content & (1U << i)) model.faults |= contentFaults[i];
+            }
+            model.seed = s_Random(&state);
+
+            const uint32_t expected = DUTExpectedErrors(model.faults);
+            const uint32_t reported = s_Decode(timing->limits, DUTWaveform(&model, waveform));
+
+            report->cases++;
+
+            if (reported != expected){
+                if (report->failed++ == 0){
+                    report->faults = model.faults;
+                    report->speed = speed;
+                    report->expected = expected;
+                    report->reported = reported;
+                }
+
+                ESP_LOGV(TAG, "faults %lx speed %d: expected %lx, got %lx", model.faults, speed, expected, reported);
+            }
+        }
+    }
+
+    report->cycles = esp_cpu_get_cycle_count() - start;
+
+    SetTargetAddress(target);
+    RulesSuspend(false);
+
+    ESP_LOGI(TAG, "%lu cases, %lu failed, %lu cycles", report->cases, report->failed, report->cycles);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "esp_cpu.h"
+
+#include "DCP.h"
+
+///////////////////////////////////////////////////////////////
+
+enum DUTFault_e {
+    FAULT_none              = 0,
+    FAULT_syncShort         = 1,
+    FAULT_syncLong          = 1 << 1,
+    FAULT_stuckLow          = 1 << 2,   //the sync never ends
+    FAULT_bitSyncShort      = 1 << 3,
+    FAULT_bitSyncLong       = 1 << 4,
+    FAULT_bitSyncStuck      = 1 << 5,   //the line stays high after the sync
+    FAULT_bitSyncLowLong    = 1 << 6,
+    FAULT_truncated         = 1 << 7,   //the last bytes are never sent
+    FAULT_extraByte         = 1 << 8,   //one byte more than the type announces
+    FAULT_badSOH            = 1 << 9,
+    FAULT_badIDS            = 1 << 10,
+    FAULT_badPAD            = 1 << 11,
+    FAULT_badCRC            = 1 << 12
+};
+
+/*!
+ * @brief software DUT, generates the edges of one L3 frame
+ *
+ * the edges are the ones the GPIO poller would see, so they feed the
+ * capture decoder directly. Even edges are falling edges
+ */
+struct DCP_DUTModel_t {
+    esp_cpu_cycle_count_t delta;    //cycles
+    float jitter;                   //max deviation of each interval, fraction of it
+    uint32_t faults;                //DUTFault_e mask
+    uint32_t seed;                  //jitter and payload
+    uint8_t addr;                   //IDS of the frames
+};
+
+//biggest waveform: an L3 frame with an extra byte
+#define DUT_MAX_EDGES (4 + 2*8*(sizeof(struct DCP_Message_L3_t) + 2))
+
+/*!
+ * @brief builds the waveform of the model
+ * @param edges = timestamps, the first one is the falling edge of the sync
+ * @return number of edges
+ */
+uint32_t DUTWaveform(const struct DCP_DUTModel_t* model, esp_cpu_cycle_count_t edges[DUT_MAX_EDGES]);
+
+//DCP_Errors_e the validator must report for the faults
+uint32_t DUTExpectedErrors(const uint32_t faults);
+
+struct DCP_SelfTest_t {
+    uint32_t cases;
+    uint32_t failed;
+    uint32_t cycles;            //spent running the cases
+
+    //first failed case
+    uint32_t faults;
+    enum DCP_Speed_e speed;
+    uint32_t expected;
+    uint32_t reported;
+};
+
+/*!
+ * @brief runs every fault combination at every speed through the capture decoder
+ *
+ * the DUT address and the profile rules are set aside while it runs and
+ * restored once it is done
+ */
+void DUTSelfTest(const uint32_t seed, struct DCP_SelfTest_t* report);
@@ -0,0 +1,105 @@
+#include "framelog.h"
+
+#include <esp_timer.h>
+#include "sdkconfig.h"
+
+#include <string.h>
+
+//fixed records ring, seq is the absolute record number
+static struct DCP_LogRecord_t records[CONFIG_DCP_LOG_RECORDS];
+static uint32_t head;
+
+//secondary indexes, the newest record of each key and, for each record,
+//the previous one sharing the key. Links are seq + 1, so 0 is no record,
+//chains end on an overwritten record
+static uint32_t newest[3][256];
+static uint32_t previous[3][CONFIG_DCP_LOG_RECORDS];
+
+///////////////////////////////////////////////////////////////
+
+static uint8_t s_Key(const struct DCP_LogRecord_t* record, const int index){
+    switch(index){
+        case 0: return record->IDS;
+        case 1: return record->IDD;
+        default: return record->COD;
+    }
+}
+
+static bool s_Alive(const uint32_t link){
+    return link != 0 && link <= head && head - link < CONFIG_DCP_LOG_RECORDS;
+}
+
+void LogReset(void){
+    head = 0;
+    memset(newest, 0, sizeof newest);
+}
+
+void LogFrame(const struct DCP_Frame_t* frame){
+
+    const uint32_t seq = head;
+    struct DCP_LogRecord_t* const record = &records[seq % CONFIG_DCP_LOG_RECORDS];
+
+    const int IDS = FrameIDS(frame);
+    const int IDD = FrameIDD(frame);
+    const int COD = FrameCOD(frame);
+
+    *record = (struct DCP_LogRecord_t){
+        .timestamp = esp_timer_get_time() / 1000,
+        .errors = frame->errors,
+        .type = frame->size? frame->data[0]: 0,
+        .IDS = IDS >= 0? IDS: 0,
+        .IDD = IDD >= 0? IDD: 0,
+        .COD = COD >= 0? COD: 0
+    };
+
+    for (int i = 0; i < 3; ++i){
+        const uint8_t key = s_Key(record, i);
+
+        previous[i][seq % CONFIG_DCP_LOG_RECORDS] = newest[i][key];
+        newest[i][key] = seq + 1;
+    }
+
+    ++head;
+}
+
+static bool s_Matches(const struct DCP_LogQuery_t* query, const struct DCP_LogRecord_t* record){
+
+    if ((query->keys & LOG_IDS) && record->IDS != query->IDS) return false;
+    if ((query->keys & LOG_IDD) && record->IDD != query->IDD) return false;
+    if ((query->keys & LOG_COD) && record->COD != query->COD) return false;
+
+    return true;
+}
+
+uint16_t LogQuery(const struct DCP_LogQuery_t* query, struct DCP_LogRecord_t* out, const uint16_t max){
+
+    const uint8_t keys[3] = {query->IDS, query->IDD, query->COD};
+    int index = -1;
+
+    //walk the chain of the first key given, the others are filtered
+    for (int i = 0; i < 3; ++i){
+        if (query->keys & (1 << i)){
+            index = i;
+            break;
+        }
+    }
+
+    uint16_t found = 0;
+    uint32_t link = index < 0? head: newest[index][keys[index]];
+
+    while (found < max && s_Alive(link)){
+        const uint32_t slot = (link - 1) % CONFIG_DCP_LOG_RECORDS;
+        const struct DCP_LogRecord_t* const record = &records[slot];
+
+        //records are in time order, nothing older is wanted
+        if ((int32_t)(record->timestamp - query->since) < 0) break;
+
+        if (s_Matches(query, record)){
+            out[found++] = *record;
+        }
+
+        link = index < 0? link - 1: previous[index][slot];
+    }
+
+    return found;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "capture.h"
+
+///////////////////////////////////////////////////////////////
+
+struct DCP_LogRecord_t {
+    uint32_t timestamp;     //ms since boot
+    uint32_t errors;        //DCP_Errors_e
+    uint8_t type;
+    uint8_t IDS;            //L3 fields, 0 for generic frames
+    uint8_t IDD;
+    uint8_t COD;
+};
+
+enum LogKey_e {
+    LOG_IDS = 1,
+    LOG_IDD = 1 << 1,
+    LOG_COD = 1 << 2
+};
+
+struct DCP_LogQuery_t {
+    unsigned keys;          //LogKey_e mask, every selected key must match
+    uint8_t IDS;
+    uint8_t IDD;
+    uint8_t COD;
+    uint32_t since;         //oldest timestamp returned, in ms
+};
+
+void LogReset(void);
+void LogFrame(const struct DCP_Frame_t* frame);
+
+/*!
+ * @brief finds the logged frames matching the query, newest first
+ * @return number of records written to out
+ *
+ * when a key is given, only the frames sharing it are visited
+ */
+uint16_t LogQuery(const struct DCP_LogQuery_t* query, struct DCP_LogRecord_t* out, const uint16_t max);
@@ -0,0 +1,314 @@
+#include "fuzz.h"
+#include "DCP_internal.h"
+#include "capture.h"
+#include "validator.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <stddef.h>
+#include <string.h>
+
+static const char* TAG = "Fuzz";
+
+static const char* const failureNames[FUZZ_FAILURE_COUNT] = {"spurious", "lockup", "hang"};
+
+//the longest low a node may drive is a 50 delta sync
+#define FUZZ_LOCKUP_DELTAS 100
+//idle after each case so the DUT closes the frame, as the capture waits for
+#define FUZZ_GAP_DELTAS 15
+//a bus held for longer than this after a lock-up ends the run
+#define FUZZ_RELEASE_US 1000000
+
+///////////////////////////////////////////////////////////////
+
+const char* FuzzFailureName(const enum DCP_FuzzFailure_e kind){
+    return kind < FUZZ_FAILURE_COUNT? failureNames[kind]: "unknown";
+}
+
+//xorshift32, same as the software DUT
+static uint32_t s_Random(uint32_t* state){
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+//a byte that is never 0, xored in so the field always changes
+static uint8_t s_Flip(uint32_t* state){
+    return 1 + s_Random(state) % 255;
+}
+
+uint8_t FuzzCase(const uint32_t seed, const uint8_t IDS, const uint8_t IDD, uint8_t frame[FUZZ_FRAME_MAX], uint16_t* mutations){
+
+    DCP_Data_t data = {.data = frame};
+    uint32_t state = seed? seed: 1;
+    uint8_t size;
+
+    memset(frame, 0, FUZZ_FRAME_MAX);
+
+    const bool generic = s_Random(&state) & 1;
+    const uint16_t fields = generic?
+        FUZZ_type | FUZZ_IDD | FUZZ_payload | FUZZ_truncate | FUZZ_extend:
+        FUZZ_type | FUZZ_IDS | FUZZ_IDD | FUZZ_COD | FUZZ_PAD | FUZZ_CRC | FUZZ_payload | FUZZ_truncate | FUZZ_extend;
+    //leaves room for the extra bytes
+    const uint8_t maxGeneric = FUZZ_FRAME_MAX - 4;
+
+    *mutations = generic? FUZZ_generic: FUZZ_none;
+
+    if (generic){
+        size = 3 + s_Random(&state) % (maxGeneric - 2);
+        data.message->type = size;
+        data.message->generic.addr = IDD;
+
+        for (uint8_t i = 2; i < size; ++i){
+            frame[i] = s_Random(&state);
+        }
+    }else{
+        size = sizeof(struct DCP_Message_t);
+        data.message->type = 0;
+        data.message->L3.SOH = DCP_L3_SOH;
+        data.message->L3.IDS = IDS;
+        data.message->L3.IDD = IDD;
+        data.message->L3.COD = s_Random(&state);
+
+        for (int i = 0; i < sizeof(data.message->L3.data); ++i){
+            data.message->L3.data[i] = s_Random(&state);
+        }
+        data.message->L3.PAD = DCP_L3_PAD;
+    }
+
+    //one to three different mutations
+    for (int n = 1 + s_Random(&state) % 3; n > 0; --n){
+        uint16_t mutation;
+
+        do {
+            mutation = 1U << (s_Random(&state) % 9);
+        } while (!(fields & mutation) || (*mutations & mutation));
+
+        *mutations |= mutation;
+
+        switch(mutation){
+            case FUZZ_type:
+                data.message->type ^= s_Flip(&state);
+                break;
+            case FUZZ_IDS:
+                data.message->L3.IDS ^= s_Flip(&state);
+                break;
+            case FUZZ_IDD:
+                if (generic){
+                    data.message->generic.addr ^= s_Flip(&state);
+                }else{
+                    data.message->L3.IDD ^= s_Flip(&state);
+                }
+                break;
+            case FUZZ_COD:
+                data.message->L3.COD ^= s_Flip(&state);
+                break;
+            case FUZZ_PAD:
+                data.message->L3.PAD ^= s_Flip(&state);
+                break;
+            case FUZZ_payload:
+                if (generic){
+                    data.message->generic.payload[s_Random(&state) % (size - 2)] ^= s_Flip(&state);
+                }else{
+                    data.message->L3.data[s_Random(&state) % sizeof(data.message->L3.data)] ^= s_Flip(&state);
+                }
+                break;
+            default:
+                //the CRC and the size are changed once the fields are final
+                break;
+        }
+    }
+
+    if (!generic){
+        //not DCPStampL3, it would put SOH and PAD back
+        data.message->L3.CRC = DCPCRC8(&data.message->L3.SOH, offsetof(struct DCP_Message_L3_t, CRC));
+        if (*mutations & FUZZ_CRC) data.message->L3.CRC ^= s_Flip(&state);
+    }
+
+    if (*mutations & FUZZ_truncate){
+        size = 1 + s_Random(&state) % (size - 1);
+    }
+
+    if (*mutations & FUZZ_extend){
+        for (int n = 1 + s_Random(&state) % 4; n > 0; --n){
+            frame[size++] = s_Random(&state);
+        }
+    }
+
+    return size;
+}
+
+///////////////////////////////////////////////////////////////
+
+static bool s_OnAnswer(const struct DCP_Frame_t* frame, const uint32_t seq, void* ctx){
+    return FrameIDS(frame) == *(const uint8_t*)ctx;
+}
+
+//false if the line is still low after timeoutUs
+static bool s_Released(const gpio_num_t pin, const int64_t timeoutUs){
+
+    const int64_t end = esp_timer_get_time() + timeoutUs;
+
+    while (gpio_get_level(pin) == 0){
+        if (esp_timer_get_time() > end) return false;
+    }
+
+    return true;
+}
+
+//waits for gapUs of idle, up to a hundred gaps
+static void s_Idle(const gpio_num_t pin, const int64_t gapUs){
+
+    const int64_t end = esp_timer_get_time() + 100*gapUs;
+
+    for (int64_t idle = esp_timer_get_time(), now = idle; now - idle < gapUs && now < end; now = esp_timer_get_time()){
+        if (gpio_get_level(pin) == 0) idle = now;
+    }
+}
+
+//a busy bus gets a few more chances
+static bool s_Send(const gpio_num_t pin, const uint32_t delays[4], const uint8_t size, const uint8_t frame[size], uint32_t* collisions){
+
+    for (int i = 0; i < 4; ++i){
+        if (!DCPSendFrame(pin, delays, size, frame)) return true;
+
+        (*collisions)++;
+        vTaskDelay(1);
+    }
+
+    return false;
+}
+
+//the DUT still answers a valid frame
+static bool s_Ping(const gpio_num_t pin, const struct DCP_Fuzz_t* fuzz, const uint32_t delays[4], uint32_t* collisions){
+
+    DCP_Data_t frame = {.message = &(struct DCP_Message_t){0}};
+
+    frame.message->type = 0;
+    frame.message->L3.IDS = fuzz->IDS;
+    frame.message->L3.IDD = fuzz->IDD;
+    frame.message->L3.COD = fuzz->pingCOD;
+    frame.message->L3.PAD = DCP_L3_PAD;
+    DCPStampL3(&frame.message->L3);
+
+    //the answer may start within the 15 delta CaptureListen would wait for
+    for (int i = 0; i < 3; ++i){
+        if (s_Send(pin, delays, sizeof(struct DCP_Message_t), frame.data, collisions)
+                && CaptureAnswer(pin, fuzz->responseMs, s_OnAnswer, (void*)&fuzz->IDD)) return true;
+    }
+
+    return false;
+}
+
+static void s_Fail(struct DCP_FuzzReport_t* report, const enum DCP_FuzzFailure_e kind, const uint32_t index,
+        const uint32_t seed, const uint16_t mutations, const uint32_t since){
+
+    report->failures[kind]++;
+
+    ESP_LOGW(TAG, "%s at case %lu, seed 0x%08lX, mutations 0x%03X", failureNames[kind], index, seed, mutations);
+
+    if (report->kept < CONFIG_DCP_FUZZ_FAILURES){
+        report->failure[report->kept++] = (struct DCP_FuzzFailure_t){
+            .kind = kind,
+            .index = index,
+            .seed = seed,
+            .mutations = mutations,
+            .since = since
+        };
+    }
+}
+
+void Fuzz(const gpio_num_t pin, const struct DCP_Fuzz_t* fuzz, struct DCP_FuzzReport_t* report){
+
+    memset(report, 0, sizeof(*report));
+
+    const float delta = DCPSpeedTiming(TargetSpeed())->delta;
+    const int64_t lockUs = FUZZ_LOCKUP_DELTAS*delta;
+    const int64_t gapUs = FUZZ_GAP_DELTAS*delta + 1;
+
+    uint32_t delays[4];
+    DCPFrameDelays(TargetSpeed(), true, NULL, delays);
+
+    const TickType_t begin = xTaskGetTickCount();
+    uint32_t state = fuzz->seed? fuzz->seed: 1;
+    //first case not covered by a liveness check yet
+    uint32_t since = 0;
+    uint32_t seed = 0;
+    uint16_t mutations = FUZZ_none;
+
+    for (uint32_t i = 0;; ++i){
+        if (fuzz->replay? i == 1: fuzz->cases && i == fuzz->cases) break;
+        if (fuzz->durationMs && pdTICKS_TO_MS(xTaskGetTickCount() - begin) >= fuzz->durationMs) break;
+
+        uint8_t frame[FUZZ_FRAME_MAX];
+
+        seed = fuzz->replay? fuzz->seed: s_Random(&state);
+        const uint8_t size = FuzzCase(seed, fuzz->IDS, fuzz->IDD, frame, &mutations);
+
+        if (!s_Send(pin, delays, size, frame, &report->collisions)){
+            //the bus never went idle, held low is a lock-up of its own
+            if (!s_Released(pin, lockUs)) s_Fail(report, FUZZ_lockup, i, seed, mutations, since);
+            report->aborted = true;
+            break;
+        }
+
+        report->cases++;
+
+        //a low line right after the case is either the sync of an answer or a lock-up
+        const esp_cpu_cycle_count_t fall = esp_cpu_get_cycle_count();
+        bool answering = gpio_get_level(pin) == 0;
+
+        if (!s_Released(pin, lockUs)){
+            s_Fail(report, FUZZ_lockup, i, seed, mutations, since);
+            answering = false;
+
+            if (!s_Released(pin, FUZZ_RELEASE_US)){
+                report->aborted = true;
+                break;
+            }
+        }
+
+        if (fuzz->windowMs){
+            //the answer may start within the 15 delta CaptureListen would wait for
+            const bool answered = answering?
+                CaptureFrom(pin, fall, fuzz->windowMs, s_OnAnswer, (void*)&fuzz->IDD):
+                CaptureAnswer(pin, fuzz->windowMs, s_OnAnswer, (void*)&fuzz->IDD);
+
+            if (answered && (mutations & ~FUZZ_ANSWERABLE)){
+                s_Fail(report, FUZZ_spurious, i, seed, mutations, since);
+            }
+        }else{
+            s_Idle(pin, gapUs);
+        }
+
+        //lets the idle task feed the watchdog
+        if (i % 64 == 63) vTaskDelay(1);
+
+        if (fuzz->pingEvery && (i+1) % fuzz->pingEvery == 0){
+            if (!s_Ping(pin, fuzz, delays, &report->collisions)){
+                s_Fail(report, FUZZ_hang, i, seed, mutations, since);
+                report->aborted = true;
+                break;
+            }
+
+            since = i+1;
+        }
+    }
+
+    //the cases after the last liveness check
+    if (!report->aborted && fuzz->pingEvery && since < report->cases && !s_Ping(pin, fuzz, delays, &report->collisions)){
+        s_Fail(report, FUZZ_hang, report->cases - 1, seed, mutations, since);
+        report->aborted = true;
+    }
+
+    report->durationMs = pdTICKS_TO_MS(xTaskGetTickCount() - begin);
+
+    ESP_LOGI(TAG, "%lu cases in %lums, %lu spurious, %lu lock-ups, %s", report->cases, report->durationMs,
+            report->failures[FUZZ_spurious], report->failures[FUZZ_lockup], report->aborted? "aborted": "finished");
+}
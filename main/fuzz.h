@@ -0,0 +1,89 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <driver/gpio.h>
+
+#include "DCP.h"
+
+///////////////////////////////////////////////////////////////
+
+//biggest frame a case can make, a generic frame with extra bytes
+#define FUZZ_FRAME_MAX 40
+
+enum DCP_FuzzMutation_e {
+    FUZZ_none       = 0,
+    FUZZ_type       = 1,
+    FUZZ_IDS        = 1 << 1,   //L3 only
+    FUZZ_IDD        = 1 << 2,   //the address byte of generic frames
+    FUZZ_COD        = 1 << 3,   //L3 only
+    FUZZ_PAD        = 1 << 4,   //L3 only
+    FUZZ_CRC        = 1 << 5,   //L3 only
+    FUZZ_payload    = 1 << 6,
+    FUZZ_truncate   = 1 << 7,
+    FUZZ_extend     = 1 << 8,
+    FUZZ_generic    = 1 << 9,   //not a mutation, the case is a generic frame
+};
+
+//frames that stay well formed and addressed to the DUT with these may be answered
+#define FUZZ_ANSWERABLE (FUZZ_IDS | FUZZ_COD | FUZZ_payload | FUZZ_generic)
+
+enum DCP_FuzzFailure_e {
+    FUZZ_spurious,      //the DUT answered a frame it had to drop
+    FUZZ_lockup,        //the bus was held low after the frame
+    FUZZ_hang,          //the DUT stopped answering the liveness frame
+    FUZZ_FAILURE_COUNT
+};
+
+/*!
+ * @brief protocol fuzzing of the DUT receiver
+ *
+ * each case is a valid L3 or generic frame to the DUT with a few random
+ * mutations, generated from its own seed so any case can be sent again
+ * alone. The cases go out back to back at the target speed, with
+ * windowMs of listening after each one for answers the DUT should not
+ * give. Every pingEvery cases, and at the end, a valid L3 frame with
+ * pingCOD must still be answered, a silent DUT ends the run
+ */
+struct DCP_Fuzz_t {
+    uint32_t seed;              //of the run, or of the only case on a replay
+    bool replay;
+    uint32_t cases;             //0 for no limit
+    uint32_t durationMs;        //0 for no limit, the first limit reached ends the run
+    uint8_t IDS;                //of the validator
+    uint8_t IDD;                //of the DUT
+    uint16_t pingEvery;         //0 for no liveness check
+    uint8_t pingCOD;
+    uint32_t windowMs;          //listening after each case, 0 for none
+    uint32_t responseMs;        //to the liveness frame
+};
+
+//only the failing cases are kept
+struct DCP_FuzzFailure_t {
+    enum DCP_FuzzFailure_e kind;
+    uint32_t index;             //of the case
+    uint32_t seed;              //replays the case
+    uint16_t mutations;         //DCP_FuzzMutation_e mask
+    uint32_t since;             //first case after the last good liveness check, for hangs
+};
+
+struct DCP_FuzzReport_t {
+    uint32_t cases;             //sent
+    uint32_t collisions;        //cases that found the bus taken, sent again
+    uint32_t failures[FUZZ_FAILURE_COUNT];
+    bool aborted;               //DUT hung or bus stuck
+    uint32_t durationMs;
+    uint16_t kept;
+    struct DCP_FuzzFailure_t failure[CONFIG_DCP_FUZZ_FAILURES];
+};
+
+///////////////////////////////////////////////////////////////
+
+const char* FuzzFailureName(const enum DCP_FuzzFailure_e kind);
+
+//builds the case of a seed, returns its size
+uint8_t FuzzCase(const uint32_t seed, const uint8_t IDS, const uint8_t IDD, uint8_t frame[FUZZ_FRAME_MAX], uint16_t* mutations);
+
+//the target bus must be set up, the cases go out at its speed
+void Fuzz(const gpio_num_t pin, const struct DCP_Fuzz_t* fuzz, struct DCP_FuzzReport_t* report);
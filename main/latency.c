@@ -0,0 +1,118 @@
+#include "latency.h"
+#include "DCP_internal.h"
+#include "capture.h"
+#include "validator.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+#include <esp_private/esp_clk.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char* TAG = "Latency";
+
+static float samples[CONFIG_DCP_LATENCY_SAMPLES];
+
+///////////////////////////////////////////////////////////////
+
+struct Answer_t {
+    uint8_t IDD;
+    esp_cpu_cycle_count_t start;
+    bool corrupted;
+};
+
+static bool s_OnAnswer(const struct DCP_Frame_t* frame, const uint32_t seq, void* ctx){
+    struct Answer_t* const answer = ctx;
+
+    if (FrameIDS(frame) != answer->IDD) return false;
+
+    answer->start = frame->start;
+    answer->corrupted = frame->errors != ERROR_none;
+    return true;
+}
+
+static int s_Compare(const void* a, const void* b){
+    const float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+static float s_Percentile(const uint32_t n, const float p){
+    return samples[(uint32_t)(p * (n - 1) + .5f)];
+}
+
+void LatencyTest(const gpio_num_t pin, const struct DCP_LatencyTest_t* test, struct DCP_LatencyReport_t* report){
+
+    memset(report, 0, sizeof(*report));
+
+    DCP_Data_t frame = {.message = &(struct DCP_Message_t){0}};
+
+    frame.message->type = 0;
+    frame.message->L3.IDS = test->IDS;
+    frame.message->L3.IDD = test->IDD;
+    frame.message->L3.COD = test->COD;
+    memcpy(frame.message->L3.data, test->data, sizeof(frame.message->L3.data));
+    frame.message->L3.PAD = DCP_L3_PAD;
+    DCPStampL3(&frame.message->L3);
+
+    uint32_t delays[4];
+    DCPFrameDelays(TargetSpeed(), true, NULL, delays);
+
+    const double toUs = 1e6/esp_clk_cpu_freq();
+    const uint32_t requests = test->requests < CONFIG_DCP_LATENCY_SAMPLES? test->requests: CONFIG_DCP_LATENCY_SAMPLES;
+    const TickType_t begin = xTaskGetTickCount();
+
+    while (report->sent < requests){
+        //a busy bus is someone else's frame, the request waits for it
+        if (DCPSendFrame(pin, delays, sizeof(struct DCP_Message_t), frame.data)){
+            report->collisions++;
+            vTaskDelay(1);
+            continue;
+        }
+
+        //same cycle counter as the capture, nothing resets it until the answer
+        const esp_cpu_cycle_count_t sent = esp_cpu_get_cycle_count();
+        struct Answer_t answer = {.IDD = test->IDD};
+
+        report->sent++;
+
+        if (CaptureAnswer(pin, test->responseMs, s_OnAnswer, &answer)){
+            samples[report->answered++] = (answer.start - sent) * toUs;
+            if (answer.corrupted) report->corrupted++;
+        }else{
+            report->missed++;
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(test->intervalMs));
+    }
+
+    report->durationMs = pdTICKS_TO_MS(xTaskGetTickCount() - begin);
+
+    const uint32_t n = report->answered;
+
+    if (n){
+        qsort(samples, n, sizeof(samples[0]), s_Compare);
+
+        report->min = samples[0];
+        report->max = samples[n-1];
+        report->p50 = s_Percentile(n, .5f);
+        report->p99 = s_Percentile(n, .99f);
+
+        double sum = 0;
+        for (uint32_t i = 0; i < n; ++i){
+            sum += samples[i];
+        }
+        report->mean = sum / n;
+
+        report->binWidth = (report->max - report->min) / LATENCY_BINS;
+        for (uint32_t i = 0; i < n; ++i){
+            const uint32_t bin = report->binWidth > 0? (samples[i] - report->min) / report->binWidth: 0;
+            report->bins[bin < LATENCY_BINS? bin: LATENCY_BINS-1]++;
+        }
+    }
+
+    ESP_LOGI(TAG, "%lu/%lu answered, %.1f/%.1f/%.1f/%.1fus min/p50/p99/max", n, report->sent,
+            report->min, report->p50, report->p99, report->max);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <driver/gpio.h>
+
+#include "DCP.h"
+
+///////////////////////////////////////////////////////////////
+
+#define LATENCY_BINS 16
+
+/*!
+ * @brief round trip latency of the DUT
+ *
+ * the validator sends an L3 request to the DUT and times from the end of
+ * its frame to the sync falling edge of the first frame from the DUT
+ * address. A request without an answer within responseMs is missed
+ */
+struct DCP_LatencyTest_t {
+    uint8_t IDS;                //of the validator
+    uint8_t IDD;                //of the DUT
+    uint8_t COD;
+    uint8_t data[6];
+    uint32_t requests;          //up to CONFIG_DCP_LATENCY_SAMPLES
+    uint32_t responseMs;
+    uint32_t intervalMs;        //between an answer and the next request
+};
+
+//times in us
+struct DCP_LatencyReport_t {
+    uint32_t sent;
+    uint32_t answered;
+    uint32_t missed;
+    uint32_t corrupted;         //answers with errors, still timed
+    uint32_t collisions;        //requests that found the bus taken, sent again
+    float min;
+    float p50;
+    float p99;
+    float max;
+    float mean;
+    float binWidth;             //the bins go from min to max
+    uint32_t bins[LATENCY_BINS];
+    uint32_t durationMs;
+};
+
+///////////////////////////////////////////////////////////////
+
+//the target bus must be set up, the requests go out at its speed
+void LatencyTest(const gpio_num_t pin, const struct DCP_LatencyTest_t* test, struct DCP_LatencyReport_t* report);
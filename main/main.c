@@ -19,13 +19,14 @@ void SanityCheck(unsigned const int size, uint8_t const msg[]){
 
 void app_main(void){
 
-    DCP_MODE mode;
+    DCP_MODE mode = {0};
     mode.addr = 0xA;
     mode.flags.flags = FLAG_Instant;
     mode.isController = true;
     mode.speed = SLOW;
 
-    if (!DCPInit(1, mode)){
+    DCP_Handle* bus = DCPInit(1, mode);
+    if (!bus){
         ESP_LOGE("MAIN", "Error initializing bus");
         return;
     }
@@ -47,11 +48,11 @@ void app_main(void){
 
         DCP_Data_t Tx = (DCP_Data_t){.data = malloc(sizeof (struct DCP_Message_t))};
         memcpy((void*)Tx.message, &msg, sizeof msg);
-        SendMessage(Tx);
+        SendMessage(bus, Tx);
 
         vTaskDelay(pdMS_TO_TICKS(100));
 
-        Rx = ReadMessage();
+        Rx = ReadMessage(bus);
 
         if (Rx) {
             DCP_Data_t debug = {.message = Rx};
@@ -0,0 +1,135 @@
+#include "margin.h"
+#include "DCP_internal.h"
+#include "capture.h"
+#include "validator.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+
+#include <math.h>
+#include <string.h>
+
+static const char* TAG = "Margin";
+
+static const char* const paramNames[MARGIN_COUNT] = {"sync", "bitSync", "bit0", "bit1"};
+
+//outer bounds of the search, fraction of the nominal width
+#define MARGIN_MIN .25f
+#define MARGIN_MAX 2.5f
+//finest step of the bisection, below it the midpoint rounds onto the bounds
+#define MARGIN_RESOLUTION .001f
+//log2((MARGIN_MAX - 1)/MARGIN_RESOLUTION) is under 11, a search never needs more
+#define MARGIN_STEPS 16
+
+///////////////////////////////////////////////////////////////
+
+const char* MarginParamName(const enum DCP_MarginParam_e param){
+    return param < MARGIN_COUNT? paramNames[param]: "unknown";
+}
+
+static bool s_OnAnswer(const struct DCP_Frame_t* frame, const uint32_t seq, void* ctx){
+    return FrameIDS(frame) == *(const uint8_t*)ctx;
+}
+
+//true if the DUT answers a frame sent with the given widths
+static bool s_Probe(const gpio_num_t pin, const struct DCP_MarginSearch_t* search, const float scales[4], uint32_t* frames){
+
+    DCP_Data_t frame = {.message = &(struct DCP_Message_t){0}};
+
+    frame.message->type = 0;
+    frame.message->L3.IDS = search->IDS;
+    frame.message->L3.IDD = search->IDD;
+    frame.message->L3.COD = search->COD;
+    frame.message->L3.PAD = DCP_L3_PAD;
+    DCPStampL3(&frame.message->L3);
+
+    uint32_t delays[4];
+    DCPFrameDelays(search->speed, true, scales, delays);
+
+    for (uint8_t i = 0; i < search->attempts; ++i){
+        //someone else on the bus, that attempt tells nothing
+        if (DCPSendFrame(pin, delays, sizeof(struct DCP_Message_t), frame.data)){
+            vTaskDelay(1);
+            continue;
+        }
+
+        (*frames)++;
+
+        //the answer may start within the 15 delta the listener would wait for
+        if (CaptureAnswer(pin, search->responseMs, s_OnAnswer, (void*)&search->IDD)) return true;
+    }
+
+    return false;
+}
+
+/*!
+ * @brief edge of the acceptance window between an accepted and an outer width
+ * @return the last accepted width, the outer one if the DUT took it too
+ */
+static float s_Bisect(const gpio_num_t pin, const struct DCP_MarginSearch_t* search, const enum DCP_MarginParam_e param,
+        float good, float bad, bool* bounded, uint32_t* frames){
+
+    float scales[4] = {1, 1, 1, 1};
+    uint32_t delays[4];
+    const float resolution = fmaxf(search->resolution, MARGIN_RESOLUTION);
+
+    //below the software overhead of the validator the width can't be sent, the outer bound starts where it can
+    scales[param] = bad;
+    while (bad < good && !DCPFrameDelays(search->speed, true, scales, delays)){
+        bad = scales[param] = fminf(bad + resolution, good);
+    }
+
+    *bounded = !s_Probe(pin, search, scales, frames);
+    if (!*bounded) return bad;
+
+    for (int i = 0; i < MARGIN_STEPS && fabsf(bad - good) > resolution; ++i){
+        scales[param] = (good + bad)/2;
+
+        if (s_Probe(pin, search, scales, frames)){
+            good = scales[param];
+        }else{
+            bad = scales[param];
+        }
+    }
+
+    return good;
+}
+
+void MarginSearch(const gpio_num_t pin, const struct DCP_MarginSearch_t* search, struct DCP_MarginReport_t* report){
+
+    memset(report, 0, sizeof(*report));
+
+    SetTargetAutoSpeed(false);
+    SetTargetSpeed(search->speed);
+
+    const TickType_t begin = xTaskGetTickCount();
+    const float delta = DCPSpeedTiming(search->speed)->delta;
+    //widths as the validator sends them, a controller sync and 8 delta bit sync halves
+    const float nominal[MARGIN_COUNT] = {25*delta, 8*delta, delta, 2*delta};
+    const float scales[4] = {1, 1, 1, 1};
+
+    report->answered = s_Probe(pin, search, scales, &report->frames);
+
+    if (!report->answered){
+        ESP_LOGW(TAG, "no answer from 0x%02X at the nominal timing", search->IDD);
+    }
+
+    for (enum DCP_MarginParam_e param = MARGIN_sync; report->answered && param < MARGIN_COUNT; ++param){
+        if (!(search->params & (1U << param))) continue;
+
+        struct DCP_Margin_t* const margin = &report->param[param];
+
+        margin->searched = true;
+        margin->nominal = nominal[param];
+        margin->low = s_Bisect(pin, search, param, 1, MARGIN_MIN, &margin->lowBounded, &report->frames);
+        margin->high = s_Bisect(pin, search, param, 1, MARGIN_MAX, &margin->highBounded, &report->frames);
+
+        ESP_LOGI(TAG, "%s: %.2f ~ %.2f of %.2fus", paramNames[param], margin->low, margin->high, margin->nominal);
+    }
+
+    report->durationMs = pdTICKS_TO_MS(xTaskGetTickCount() - begin);
+
+    ESP_LOGI(TAG, "%lu frames in %lums", report->frames, report->durationMs);
+}
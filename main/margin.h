@@ -0,0 +1,61 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <driver/gpio.h>
+
+#include "DCP.h"
+
+///////////////////////////////////////////////////////////////
+
+enum DCP_MarginParam_e {
+    MARGIN_sync,
+    MARGIN_bitSync,     //both halves
+    MARGIN_bit0,        //high time
+    MARGIN_bit1,        //high time, the sender ties the low time to it
+    MARGIN_COUNT
+};
+
+/*!
+ * @brief receiver margin search
+ *
+ * the validator sends L3 frames to the DUT with one part of the frame
+ * stretched or compressed and takes any frame from the DUT address, within
+ * responseMs, as the frame having been accepted. Each side of each part is
+ * bisected between the nominal width and an outer bound, so the window
+ * comes in a few frames per part
+ */
+struct DCP_MarginSearch_t {
+    enum DCP_Speed_e speed;
+    uint8_t params;         //bit per DCP_MarginParam_e
+    uint8_t IDS;            //of the validator
+    uint8_t IDD;            //of the DUT, the frames from it are the answers
+    uint8_t COD;            //a command the DUT answers to
+    float resolution;       //of the bisection, fraction of the nominal width, .001 at the finest
+    uint8_t attempts;       //frames sent at a width before it counts as rejected, at least 1
+    uint32_t responseMs;
+};
+
+struct DCP_Margin_t {
+    bool searched;
+    float nominal;          //us on the wire
+    float low;              //smallest accepted width, fraction of the nominal
+    float high;             //biggest accepted width
+    bool lowBounded;        //false if the DUT still answered at the outer bound, raised to the shortest width the validator can send
+    bool highBounded;
+};
+
+struct DCP_MarginReport_t {
+    bool answered;          //the DUT answered the nominal frame, nothing is searched otherwise
+    struct DCP_Margin_t param[MARGIN_COUNT];
+    uint32_t frames;
+    uint32_t durationMs;
+};
+
+///////////////////////////////////////////////////////////////
+
+const char* MarginParamName(const enum DCP_MarginParam_e param);
+
+//the target timing is set to the speed of the search
+void MarginSearch(const gpio_num_t pin, const struct DCP_MarginSearch_t* search, struct DCP_MarginReport_t* report);
@@ -0,0 +1,230 @@
+#include "multinode.h"
+#include "DCP_internal.h"
+#include "capture.h"
+#include "validator.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_private/esp_clk.h>
+
+#include <string.h>
+
+static const char* TAG = "MultiNode";
+
+//the longest frame of the slowest class fits in it
+#define MULTINODE_FRAME_MS 200
+//as the capture, a frame in progress never leaves the bus idle this long
+#define MULTINODE_QUIET_DELTAS 15
+
+///////////////////////////////////////////////////////////////
+
+//xorshift32, same as the software DUT
+static uint32_t s_Random(uint32_t* state){
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static uint8_t s_BuildFrame(const struct DCP_VirtualNode_t* node, uint32_t* state, uint8_t data[]){
+
+    DCP_Data_t frame = {.data = data};
+
+    if (node->size){
+        frame.message->type = node->size;
+        //the address byte of generic frames is the destination, as the driver filters it
+        frame.message->generic.addr = node->IDD;
+
+        for (int i = 2; i < node->size; ++i){
+            data[i] = s_Random(state);
+        }
+
+        return node->size;
+    }
+
+    frame.message->type = 0;
+    frame.message->L3.IDS = node->addr;
+    frame.message->L3.IDD = node->IDD;
+    frame.message->L3.COD = s_Random(state);
+
+    for (int i = 0; i < sizeof(frame.message->L3.data); ++i){
+        frame.message->L3.data[i] = s_Random(state);
+    }
+    frame.message->L3.PAD = DCP_L3_PAD;
+
+    DCPStampL3(&frame.message->L3);
+
+    return sizeof(struct DCP_Message_t);
+}
+
+//only the DUT talks besides the validator, every frame heard is its own
+struct Heard_t {
+    bool first;
+    uint32_t frames;
+    uint32_t corrupted;
+};
+
+static bool s_OnFrame(const struct DCP_Frame_t* frame, const uint32_t seq, void* ctx){
+    struct Heard_t* const heard = ctx;
+
+    heard->frames++;
+    if (frame->errors != ERROR_none) heard->corrupted++;
+
+    return heard->first;
+}
+
+//waits for a quiet bus, returns when it went idle
+static esp_cpu_cycle_count_t s_Quiet(const gpio_num_t pin, const esp_cpu_cycle_count_t quiet){
+
+    const TickType_t begin = xTaskGetTickCount();
+    esp_cpu_cycle_count_t idle = esp_cpu_get_cycle_count();
+    unsigned n = 0;
+
+    for (esp_cpu_cycle_count_t now = idle; now - idle < quiet; now = esp_cpu_get_cycle_count(), ++n){
+        if (gpio_get_level(pin) == 0) idle = now;
+
+        //a stuck bus is left to the send to find
+        if ((n & 0xFF) == 0 && xTaskGetTickCount() - begin > pdMS_TO_TICKS(MULTINODE_FRAME_MS)) break;
+    }
+
+    return idle;
+}
+
+//waits the priority delay from idle, false with the falling edge if someone took the bus first
+static bool s_Arbitrate(const gpio_num_t pin, const esp_cpu_cycle_count_t idle, const esp_cpu_cycle_count_t delay, esp_cpu_cycle_count_t* fall){
+
+    for (;;){
+        const esp_cpu_cycle_count_t now = esp_cpu_get_cycle_count();
+
+        if (gpio_get_level(pin) == 0){
+            *fall = now;
+            return false;
+        }
+
+        if (now - idle >= delay) return true;
+    }
+}
+
+void MultiNodeTest(const gpio_num_t pin, const struct DCP_MultiNode_t* test, struct DCP_MultiNodeReport_t* report){
+
+    memset(report, 0, sizeof(*report));
+
+    uint32_t delays[4];
+    DCPFrameDelays(TargetSpeed(), true, NULL, delays);
+
+    const uint32_t freqMHz = esp_clk_cpu_freq()/1e6;
+    const float delta = DCPSpeedTiming(TargetSpeed())->delta;
+    const esp_cpu_cycle_count_t slot = delta/4.0 * freqMHz;
+    const esp_cpu_cycle_count_t quiet = MULTINODE_QUIET_DELTAS * delta * freqMHz;
+
+    const int64_t begin = esp_timer_get_time();
+    const int64_t end = begin + (int64_t)test->durationMs*1000;
+
+    uint32_t queued[MULTINODE_MAX] = {0};
+    int64_t due[MULTINODE_MAX];
+    for (int i = 0; i < test->nodes; ++i){
+        due[i] = begin;
+    }
+
+    uint32_t state = test->seed? test->seed: 1;
+    uint8_t frame[CAPTURE_FRAME_MAX];
+    struct Heard_t heard = {0};
+    //the start of the idle bus is only known right after a virtual frame
+    bool known = false;
+    esp_cpu_cycle_count_t idle = 0;
+
+    for (int64_t now = begin; now < end; now = esp_timer_get_time()){
+        int winner = -1;
+        int64_t next = end;
+
+        for (int i = 0; i < test->nodes; ++i){
+            for (; due[i] <= now; due[i] += (int64_t)test->node[i].periodMs*1000){
+                queued[i] += test->node[i].burst;
+            }
+
+            if (due[i] < next) next = due[i];
+            if (queued[i] && (winner < 0 || test->node[i].addr < test->node[winner].addr)) winner = i;
+        }
+
+        if (winner < 0){
+            //the DUT has the bus to itself until the next frame is due, right after
+            //a virtual frame it may already be answering within the idle wait of CaptureListen
+            if (known){
+                (void)CaptureAnswer(pin, (next - now + 999)/1000, s_OnFrame, &heard);
+            }else{
+                (void)CaptureListen(pin, (next - now + 999)/1000, s_OnFrame, &heard);
+            }
+            known = false;
+            continue;
+        }
+
+        const struct DCP_VirtualNode_t* const node = &test->node[winner];
+        struct DCP_NodeResult_t* const result = &report->node[winner];
+        const bool outranks = node->addr < test->DUT;
+        const esp_cpu_cycle_count_t delay = (node->addr + 6) * slot;
+        esp_cpu_cycle_count_t fall;
+
+        if (!known) idle = s_Quiet(pin, quiet);
+
+        if (!s_Arbitrate(pin, idle, delay, &fall)){
+            //half a slot covers the lag between releasing the bus and reading the counter
+            if (known && outranks && fall - idle + slot/2 < delay){
+                result->violations++;
+                ESP_LOGW(TAG, "DUT started %.2fus after the bus went idle, before 0x%02X", (fall - idle)/(float)freqMHz, node->addr);
+            }else{
+                result->deferred++;
+            }
+
+            struct Heard_t won = {.first = true};
+            (void)CaptureFrom(pin, fall, MULTINODE_FRAME_MS, s_OnFrame, &won);
+
+            report->contended += won.frames;
+            report->contendedCorrupted += won.corrupted;
+            known = false;
+            continue;
+        }
+
+        const uint8_t size = s_BuildFrame(node, &state, frame);
+
+        //the lower address wins the bitwise arbitration of the first bytes
+        if (DCPSendFrame(pin, delays, size, frame)){
+            if (outranks){
+                result->violations++;
+                ESP_LOGW(TAG, "DUT collided with 0x%02X and kept the bus", node->addr);
+            }else{
+                result->lost++;
+            }
+
+            known = false;
+            continue;
+        }
+
+        idle = esp_cpu_get_cycle_count();
+        known = true;
+        queued[winner]--;
+
+        //lets the idle task feed the watchdog
+        if (++result->sent % 64 == 0){
+            vTaskDelay(1);
+            known = false;
+        }
+    }
+
+    report->dutFrames = heard.frames;
+    report->dutCorrupted = heard.corrupted;
+    report->passed = heard.corrupted == 0 && report->contendedCorrupted == 0;
+
+    for (int i = 0; i < test->nodes; ++i){
+        report->node[i].pending = queued[i];
+        report->passed &= report->node[i].violations == 0;
+
+        ESP_LOGI(TAG, "0x%02X: %lu sent, %lu deferred, %lu lost, %lu violations", test->node[i].addr,
+                report->node[i].sent, report->node[i].deferred, report->node[i].lost, report->node[i].violations);
+    }
+
+    report->durationMs = (esp_timer_get_time() - begin)/1000;
+}
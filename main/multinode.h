@@ -0,0 +1,63 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <driver/gpio.h>
+
+#include "DCP.h"
+
+///////////////////////////////////////////////////////////////
+
+#define MULTINODE_MAX 8
+
+//one node emulated by the validator
+struct DCP_VirtualNode_t {
+    uint8_t addr;           //the smaller, the higher the priority
+    uint8_t IDD;            //destination of its frames, the address byte of generic ones
+    uint8_t size;           //0 for L3 frames, the size of its generic frames otherwise
+    uint32_t periodMs;
+    uint8_t burst;          //frames queued every period
+};
+
+/*!
+ * @brief arbitration of the DUT on a crowded bus
+ *
+ * the validator plays every virtual node on the same pin. Queued frames go
+ * out highest priority first, each after the (addr + 6) * delta/4 of idle
+ * bus of its node, as the bus handler does. The DUT priority is judged
+ * right after a virtual frame, when the start of the idle bus is known:
+ * starting before a higher priority node, or colliding with one, is a
+ * violation. The DUT frames that win the bus, and those sent while the
+ * virtual nodes are quiet, must have no errors
+ */
+struct DCP_MultiNode_t {
+    uint8_t DUT;            //address of the DUT
+    uint8_t nodes;
+    struct DCP_VirtualNode_t node[MULTINODE_MAX];
+    uint32_t durationMs;
+    uint32_t seed;          //of the frame contents
+};
+
+struct DCP_NodeResult_t {
+    uint32_t sent;
+    uint32_t deferred;      //the DUT took the bus first, without a violation
+    uint32_t lost;          //collisions lost to the DUT, as its priority allows
+    uint32_t violations;    //the DUT took the bus, or collided, against this node priority
+    uint32_t pending;       //frames still queued at the end
+};
+
+struct DCP_MultiNodeReport_t {
+    struct DCP_NodeResult_t node[MULTINODE_MAX];
+    uint32_t dutFrames;     //heard while no virtual frame was queued
+    uint32_t dutCorrupted;
+    uint32_t contended;     //DUT frames that won the bus over a queued virtual frame
+    uint32_t contendedCorrupted;
+    bool passed;
+    uint32_t durationMs;
+};
+
+///////////////////////////////////////////////////////////////
+
+//the target bus must be set up, the virtual nodes talk at its speed
+void MultiNodeTest(const gpio_num_t pin, const struct DCP_MultiNode_t* test, struct DCP_MultiNodeReport_t* report);
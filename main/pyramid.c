@@ -0,0 +1,99 @@
+#include "pyramid.h"
+
+#include <esp_log.h>
+#include "sdkconfig.h"
+
+#include <string.h>
+
+static const char* TAG = "Pyramid";
+
+_Static_assert((CONFIG_DCP_PYRAMID_BINS & (CONFIG_DCP_PYRAMID_BINS - 1)) == 0, "pyramid bins must be a power of 2");
+_Static_assert(CONFIG_DCP_PYRAMID_BINS >= PYRAMID_TILE_BINS, "pyramid must hold at least one tile");
+
+//all levels back to back, level 0 first
+static uint8_t bins[2*CONFIG_DCP_PYRAMID_BINS];
+static struct DCP_Pyramid_t pyramid;
+
+///////////////////////////////////////////////////////////////
+
+static uint32_t s_LevelOffset(const uint8_t level){
+    //N + N/2 + ... for the levels below
+    return 2*CONFIG_DCP_PYRAMID_BINS - (2*CONFIG_DCP_PYRAMID_BINS >> level);
+}
+
+static uint8_t s_Merge(const uint8_t a, const uint8_t b){
+    uint16_t edges = (a & PYRAMID_BIN_EDGES) + (b & PYRAMID_BIN_EDGES);
+
+    if (edges > PYRAMID_BIN_EDGES) edges = PYRAMID_BIN_EDGES;
+
+    return ((a | b) & (PYRAMID_BIN_HIGH | PYRAMID_BIN_LOW)) | edges;
+}
+
+bool PyramidBuild(void){
+
+    const struct DCP_Capture_t* const capture = CaptureGet();
+
+    pyramid = (struct DCP_Pyramid_t){0};
+
+    if (capture->edges < 2){
+        ESP_LOGW(TAG, "nothing captured");
+        return false;
+    }
+
+    const esp_cpu_cycle_count_t origin = CaptureEdge(0);
+    const esp_cpu_cycle_count_t span = CaptureEdge(capture->edges - 1) - origin + 1;
+
+    pyramid.binCycles = (span + CONFIG_DCP_PYRAMID_BINS - 1) / CONFIG_DCP_PYRAMID_BINS;
+
+    //single pass over the edges, the window starts idle (high)
+    uint32_t edge = 0;
+    int level = 1;
+
+    for (uint32_t i = 0; i < CONFIG_DCP_PYRAMID_BINS; ++i){
+        const esp_cpu_cycle_count_t end = (i + 1) * pyramid.binCycles;
+        uint8_t bin = level? PYRAMID_BIN_HIGH: PYRAMID_BIN_LOW;
+        uint32_t edges = 0;
+
+        for (; edge < capture->edges && CaptureEdge(edge) - origin < end; ++edge){
+            //even edges are falling
+            level = edge & 1;
+            bin |= level? PYRAMID_BIN_HIGH: PYRAMID_BIN_LOW;
+            ++edges;
+        }
+
+        bins[i] = bin | (edges > PYRAMID_BIN_EDGES? PYRAMID_BIN_EDGES: edges);
+    }
+
+    //every level halves the one below, down to a single tile
+    pyramid.levels = 1;
+
+    for (uint32_t n = CONFIG_DCP_PYRAMID_BINS >> 1; n >= PYRAMID_TILE_BINS; n >>= 1, ++pyramid.levels){
+        const uint8_t* const below = &bins[s_LevelOffset(pyramid.levels - 1)];
+        uint8_t* const above = &bins[s_LevelOffset(pyramid.levels)];
+
+        for (uint32_t i = 0; i < n; ++i){
+            above[i] = s_Merge(below[2*i], below[2*i + 1]);
+        }
+    }
+
+    ESP_LOGI(TAG, "%u levels, %lu cycles per bin", pyramid.levels, pyramid.binCycles);
+
+    return true;
+}
+
+const struct DCP_Pyramid_t* PyramidGet(void){
+    return &pyramid;
+}
+
+uint16_t PyramidTile(const uint8_t level, const uint16_t tile, uint8_t out[PYRAMID_TILE_BINS]){
+
+    if (level >= pyramid.levels) return 0;
+
+    const uint32_t n = CONFIG_DCP_PYRAMID_BINS >> level;
+
+    if ((uint32_t)(tile + 1) * PYRAMID_TILE_BINS > n) return 0;
+
+    memcpy(out, &bins[s_LevelOffset(level) + tile * PYRAMID_TILE_BINS], PYRAMID_TILE_BINS);
+
+    return PYRAMID_TILE_BINS;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "capture.h"
+
+///////////////////////////////////////////////////////////////
+
+//bins sent on each tile request, whatever the zoom
+#define PYRAMID_TILE_BINS 256
+
+//each bin packs the bus levels seen and the saturated edge count
+#define PYRAMID_BIN_HIGH    0x80
+#define PYRAMID_BIN_LOW     0x40
+#define PYRAMID_BIN_EDGES   0x3F
+
+struct DCP_Pyramid_t {
+    uint8_t levels;                 //level 0 is the finest
+    esp_cpu_cycle_count_t binCycles;//time covered by a level 0 bin
+};
+
+/*!
+ * @brief builds the level of detail pyramid of the captured window
+ *
+ * the edges are read once, level 0 has CONFIG_DCP_PYRAMID_BINS bins
+ * and every level above halves it, down to a single tile
+ */
+bool PyramidBuild(void);
+
+const struct DCP_Pyramid_t* PyramidGet(void);
+
+//copies the tile bins to out, returns the number of bins or 0 if it doesn't exist
+uint16_t PyramidTile(const uint8_t level, const uint16_t tile, uint8_t out[PYRAMID_TILE_BINS]);
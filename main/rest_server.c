@@ -15,8 +15,24 @@
 #include "esp_vfs.h"
 #include "cJSON.h"
 
+#include <esp_private/esp_clk.h>
+
 #include "DCP.h"
 #include "validator.h"
+#include "capture.h"
+#include "rules.h"
+#include "busstats.h"
+#include "framelog.h"
+#include "pyramid.h"
+#include "tracecodec.h"
+#include "dutmodel.h"
+#include "testplan.h"
+#include "sweep.h"
+#include "margin.h"
+#include "fuzz.h"
+#include "latency.h"
+#include "capacity.h"
+#include "multinode.h"
 
 static const char *REST_TAG = "esp-rest";
 #define REST_CHECK(a, str, goto_tag, ...)                                              \
@@ -55,6 +71,8 @@ static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filepa
         type = "image/x-icon";
     } else if (CHECK_FILE_EXTENSION(filepath, ".svg")) {
         type = "text/xml";
+    } else if (CHECK_FILE_EXTENSION(filepath, ".dcpt")) {
+        type = "application/octet-stream";
     }
     return httpd_resp_set_type(req, type);
 }
@@ -114,8 +132,8 @@ void AddToJSON(cJSON* root, char const * name, const float value){
     cJSON_AddItemToObject(root, name, JSONvalue);
 }
 
-/* Simple handler for getting system handler */
-static esp_err_t system_info_get_handler(httpd_req_t *req)
+/* Receive the request body and parse it as JSON, responds with the error on failure */
+static cJSON* ReceiveJSON(httpd_req_t *req)
 {
     int total_len = req->content_len;
     int cur_len = 0;
@@ -126,7 +144,7 @@ static esp_err_t system_info_get_handler(httpd_req_t *req)
     if (total_len >= SCRATCH_BUFSIZE) {
         /* Respond with 500 Internal Server Error */
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "content too long");
-        return ESP_FAIL;
+        return NULL;
     }
 
     while (cur_len < total_len) {
@@ -134,7 +152,7 @@ static esp_err_t system_info_get_handler(httpd_req_t *req)
         if (received <= 0) {
             /* Respond with 500 Internal Server Error */
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to post device data");
-            return ESP_FAIL;
+            return NULL;
         }
         cur_len += received;
     }
@@ -143,13 +161,63 @@ static esp_err_t system_info_get_handler(httpd_req_t *req)
     cJSON *root = cJSON_Parse(buf);
     if(!root) {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid request");
-        return ESP_FAIL;
+        return NULL;
     }
 
-    bool isController = cJSON_IsTrue(cJSON_GetObjectItem(root, "isController"));
-    int deviceSpeed = cJSON_GetObjectItem(root, "deviceSpeed")->valueint;
+    return root;
+}
 
-    cJSON_Delete(root);
+/* Load the DUT profile rules of the request, they replace the previous profile */
+static bool ParseRules(const cJSON *json)
+{
+    const cJSON *item;
+
+    RulesClear();
+
+    cJSON_ArrayForEach(item, json) {
+        const cJSON *set = cJSON_GetObjectItem(item, "set");
+        const cJSON *kind = cJSON_GetObjectItem(item, "kind");
+        const cJSON *offset = cJSON_GetObjectItem(item, "offset");
+        const cJSON *mask = cJSON_GetObjectItem(item, "mask");
+        const cJSON *min = cJSON_GetObjectItem(item, "min");
+        const cJSON *max = cJSON_GetObjectItem(item, "max");
+        const cJSON *error = cJSON_GetObjectItem(item, "error");
+
+        if (!cJSON_IsNumber(offset) || !cJSON_IsNumber(error)) {
+            return false;
+        }
+
+        struct DCP_Rule_t rule = {
+            .kind = RULE_range,
+            .offset = offset->valueint,
+            .mask = cJSON_IsNumber(mask)? mask->valueint: 0xFF,
+            .min = cJSON_IsNumber(min)? min->valueint: 0,
+            .error = error->valuedouble
+        };
+        rule.max = cJSON_IsNumber(max)? max->valueint: rule.min;
+
+        if (cJSON_IsString(kind) && strcmp(kind->valuestring, "target") == 0) {
+            rule.kind = RULE_target;
+        } else if (cJSON_IsString(kind) && strcmp(kind->valuestring, "crc") == 0) {
+            rule.kind = RULE_CRC;
+        }
+
+        const bool generic = cJSON_IsString(set) && strcmp(set->valuestring, "generic") == 0;
+
+        if (!RulesAdd(generic? RULES_generic: RULES_L3, rule)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Set up the DUT params of the request, responds with the error on failure */
+static bool SetupTarget(httpd_req_t *req, const cJSON *root)
+{
+    bool isController = cJSON_IsTrue(cJSON_GetObjectItem(root, "isController"));
+    const cJSON *speed = cJSON_GetObjectItem(root, "deviceSpeed");
+    int deviceSpeed = cJSON_IsNumber(speed)? speed->valueint: 0;
 
     unsigned busSpeed = SLOW;
     switch(deviceSpeed){
@@ -160,28 +228,61 @@ static esp_err_t system_info_get_handler(httpd_req_t *req)
         default: break;
     }
 
-    const DCP_MODE mode = {.addr = 0xFF, .flags.flags = FLAG_Instant, .isController = isController, .speed = busSpeed};
+    const cJSON *address = cJSON_GetObjectItem(root, "deviceAddress");
+    SetTargetAddress(cJSON_IsNumber(address)? address->valueint: 0);
+
+    if (!ParseRules(cJSON_GetObjectItem(root, "rules"))) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid rules");
+        return false;
+    }
+
+    //only the timing of the DUT speed, a live bus would take the pin the tests poll
+    SetTargetSpeed(busSpeed);
+    SetTargetController(isController);
+
+    //"auto" finds the speed class from the first sync of each capture
+    SetTargetAutoSpeed(cJSON_IsString(speed) && strcmp(speed->valuestring, "auto") == 0);
+
+    return true;
+}
+
+/* Simple handler for getting system handler */
+static esp_err_t system_info_get_handler(httpd_req_t *req)
+{
+    cJSON *root = ReceiveJSON(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+
     const gpio_num_t pin = 1;
 
-    if (!DCPInit(pin, mode)){
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Could not init bus");
+    if (!SetupTarget(req, root)) {
+        cJSON_Delete(root);
         return ESP_FAIL;
     }
 
+    //the ADC sampling can be turned off for the fastest speeds, its interrupts delay the edge poller
+    const bool adc = !cJSON_IsFalse(cJSON_GetObjectItem(root, "adc"));
+
+    cJSON_Delete(root);
+
     ESP_LOGI(REST_TAG, "Performing validation");
 
-    //performing validation
-    struct DCP_electrical_t electrical = MeasureElectrical(pin);
+    //performing validation, electrical, timing and framing from the same frames
+    struct DCP_Validation_t validation;
+    (void)ValidateTraffic(pin, CONFIG_DCP_VALIDATION_FRAMES, 10000, adc, &validation);
+
+    const struct DCP_electrical_t electrical = validation.electrical;
     ESP_LOGV("[validation]", "VIH: %f\tVIL: %f\trise: %f\tfall: %f\tcycle: %f\tspeed: %f",
         electrical.VIH, electrical.VIL, electrical.rise, electrical.falling, electrical.cycle, electrical.speed);
 
-    struct DCP_Transmission_t transmission = TestConnection(pin);
+    const struct DCP_Transmission_t transmission = validation.transmission;
     ESP_LOGV("[validation]", "error: 0x%X", transmission.errors);
-    struct DCP_timings_t timings = GetTimes(pin);
+    const struct DCP_timings_t timings = validation.timings;
     ESP_LOGV("[validation]", "sync: %f\tBS_low: %f\tBS_high: %f\tbit0: %f\tbit1: %f",
         timings.sync, timings.bitSync_low, timings.bitSync_high, timings.bit0, timings.bit1);
 
-    enum Collision_e yield = DoesYield(pin);
+    enum Collision_e yield = DoesYield(pin, 10000);
     ESP_LOGV("[validation]", "yield: %d", yield);
 
     //sending result
@@ -218,6 +319,7 @@ static esp_err_t system_info_get_handler(httpd_req_t *req)
     cJSON* JSON_transmission = cJSON_CreateObject();
     cJSON_AddItemToObject(root, "transmissionInfo", JSON_transmission);
     AddToJSON(JSON_transmission, "Type", transmission.type);
+    AddToJSON(JSON_transmission, "Frames", validation.frames);
     
     //sync bitsync size
     if(transmission.errors & (ERROR_sync_inf | ERROR_sync_tooLong | ERROR_sync_tooShort)){
@@ -288,28 +390,1696 @@ static esp_err_t system_info_get_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-esp_err_t start_rest_server(const char *base_path)
+/* Read the trigger from the request, fields that are absent don't take part */
+static void ParseTrigger(const cJSON *json, struct DCP_Trigger_t *trigger)
 {
-    REST_CHECK(base_path, "wrong base path", err);
-    rest_server_context_t *rest_context = calloc(1, sizeof(rest_server_context_t));
-    REST_CHECK(rest_context, "No memory for rest context", err);
-    strlcpy(rest_context->base_path, base_path, sizeof(rest_context->base_path));
+    const char names[][5] = {"IDS", "IDD", "COD", "type"};
+    uint8_t *const values[] = {&trigger->IDS, &trigger->IDD, &trigger->COD, &trigger->type};
+    const cJSON *item;
 
-    httpd_handle_t server = NULL;
-    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.uri_match_fn = httpd_uri_match_wildcard;
+    *trigger = (struct DCP_Trigger_t){.preFrames = 4, .postFrames = 1};
 
-    ESP_LOGI(REST_TAG, "Starting HTTP Server");
-    REST_CHECK(httpd_start(&server, &config) == ESP_OK, "Start server failed", err_start);
+    if (!json) {
+        return;
+    }
 
-    /* URI handler for fetching system info */
-    httpd_uri_t system_info_get_uri = {
-        .uri = "/api/v1/validation",
-        .method = HTTP_POST,
-        .handler = system_info_get_handler,
-        .user_ctx = rest_context
+    for (int i = 0; i < 4; ++i) {
+        item = cJSON_GetObjectItem(json, names[i]);
+        if (cJSON_IsNumber(item)) {
+            trigger->fields |= TRIGGER_IDS << i;
+            *values[i] = item->valueint;
+        }
+    }
+
+    item = cJSON_GetObjectItem(json, "errors");
+    if (cJSON_IsTrue(item)) {
+        trigger->fields |= TRIGGER_error;
+    } else if (cJSON_IsNumber(item)) {
+        trigger->fields |= TRIGGER_error;
+        trigger->errorMask = item->valuedouble;
+    }
+
+    item = cJSON_GetObjectItem(json, "pre");
+    if (cJSON_IsNumber(item)) {
+        trigger->preFrames = item->valueint;
+    }
+
+    item = cJSON_GetObjectItem(json, "post");
+    if (cJSON_IsNumber(item)) {
+        trigger->postFrames = item->valueint;
+    }
+}
+
+/* Handler for the triggered capture, responds with the kept window */
+static esp_err_t capture_post_handler(httpd_req_t *req)
+{
+    cJSON *root = ReceiveJSON(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+
+    const gpio_num_t pin = 1;
+
+    if (!SetupTarget(req, root)) {
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    struct DCP_Trigger_t trigger;
+    ParseTrigger(cJSON_GetObjectItem(root, "trigger"), &trigger);
+
+    const cJSON *timeout = cJSON_GetObjectItem(root, "timeout");
+    const uint32_t timeoutMs = cJSON_IsNumber(timeout)? timeout->valuedouble * 1e3: 10000;
+
+    //long windows are better browsed through the pyramid tiles
+    const bool sendEdges = !cJSON_IsFalse(cJSON_GetObjectItem(root, "edges"));
+
+    cJSON_Delete(root);
+
+    ESP_LOGI(REST_TAG, "Capturing");
+    CaptureRun(pin, &trigger, timeoutMs);
+    PyramidBuild();
+
+    const struct DCP_Capture_t *capture = CaptureGet();
+    const double freqMHz = esp_clk_cpu_freq()/1e6;
+
+    httpd_resp_set_type(req, "application/json");
+
+    root = cJSON_CreateObject();
+    cJSON_AddItemToObject(root, "triggered", cJSON_CreateBool(capture->triggered));
+    AddToJSON(root, "trigger", capture->trigger);
+
+    //times are in us from the first kept edge
+    const esp_cpu_cycle_count_t origin = capture->edges? CaptureEdge(0): 0;
+
+    cJSON *frames = cJSON_CreateArray();
+    cJSON_AddItemToObject(root, "frames", frames);
+
+    for (uint16_t i = 0; i < capture->frames; ++i) {
+        const struct DCP_Frame_t *frame = CaptureFrame(i);
+
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddItemToArray(frames, item);
+
+        AddToJSON(item, "start", (int32_t)(frame->start - origin) / freqMHz);
+        AddToJSON(item, "end", (int32_t)(frame->end - origin) / freqMHz);
+        AddToJSON(item, "errors", frame->errors);
+
+        cJSON *data = cJSON_CreateArray();
+        cJSON_AddItemToObject(item, "data", data);
+
+        for (uint16_t j = 0; j < frame->size; ++j) {
+            cJSON_AddItemToArray(data, cJSON_CreateNumber(frame->data[j]));
+        }
+    }
+
+    AddToJSON(root, "levels", PyramidGet()->levels);
+
+    //even edges are falling, odd edges are rising
+    if (sendEdges) {
+        cJSON *edges = cJSON_CreateArray();
+        cJSON_AddItemToObject(root, "edges", edges);
+
+        for (uint32_t i = 0; i < capture->edges; ++i) {
+            cJSON_AddItemToArray(edges, cJSON_CreateNumber((CaptureEdge(i) - origin) / freqMHz));
+        }
+    }
+
+    const char *captureResult = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, captureResult);
+    free((void *)captureResult);
+
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+/* Fill the response with the running bus statistics */
+static esp_err_t SendStats(httpd_req_t *req)
+{
+    const struct DCP_BusStats_t *stats = StatsGet();
+    const struct DCP_TrafficPair_t *pairs = StatsPairs();
+    const double seconds = stats->elapsed / 1e6;
+
+    httpd_resp_set_type(req, "application/json");
+
+    cJSON *root = cJSON_CreateObject();
+
+    AddToJSON(root, "Elapsed", seconds);
+    AddToJSON(root, "Frames", stats->frames);
+    AddToJSON(root, "Bytes", stats->bytes);
+    AddToJSON(root, "Collisions", stats->collisions);
+
+    if (seconds > 0) {
+        AddToJSON(root, "Bus Busy", 100 * (stats->busy / (double)esp_clk_cpu_freq()) / seconds);
+        AddToJSON(root, "Frames per Second", stats->frames / seconds);
+        AddToJSON(root, "Bytes per Second", stats->bytes / seconds);
+    }
+
+    //error classes, the same grouping of the validation report
+    const struct {char name[10]; uint32_t mask;} classes[] = {
+        {"Sync", ERROR_sync_inf | ERROR_sync_tooLong | ERROR_sync_tooShort},
+        {"BitSync", ERROR_bitSync_inf | ERROR_bitSync_tooLong | ERROR_bitSync_tooShort | ERROR_bitSync_invalidLow},
+        {"Size", ERROR_invalidSize},
+        {"Generic", ERROR_message_invalidGeneric},
+        {"L3", ERROR_message_invalidL3_header | ERROR_message_invalidL3_sID | ERROR_message_invalidL3_padding | ERROR_message_invalidL3_CRC}
     };
-    httpd_register_uri_handler(server, &system_info_get_uri);
+
+    cJSON *errors = cJSON_CreateObject();
+    cJSON_AddItemToObject(root, "Errors", errors);
+
+    for (int i = 0; i < sizeof classes / sizeof classes[0]; ++i) {
+        uint32_t count = 0;
+        for (int bit = 0; bit < 32; ++bit) {
+            if (classes[i].mask & (1UL << bit)) {
+                count += stats->errors[bit];
+            }
+        }
+        AddToJSON(errors, classes[i].name, count);
+    }
+
+    cJSON *matrix = cJSON_CreateArray();
+    cJSON_AddItemToObject(root, "Traffic", matrix);
+
+    for (int i = 0; i < CONFIG_DCP_STATS_PAIRS; ++i) {
+        if (pairs[i].count == 0) {
+            continue;
+        }
+
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddItemToArray(matrix, item);
+        AddToJSON(item, "IDS", pairs[i].IDS);
+        AddToJSON(item, "IDD", pairs[i].IDD);
+        AddToJSON(item, "count", pairs[i].count);
+    }
+    AddToJSON(root, "Dropped Pairs", stats->droppedPairs);
+
+    const char *statsResult = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, statsResult);
+    free((void *)statsResult);
+
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+/* Handler for the passive monitoring, folds the session in the running statistics */
+static esp_err_t monitor_post_handler(httpd_req_t *req)
+{
+    cJSON *root = ReceiveJSON(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+
+    const gpio_num_t pin = 1;
+
+    if (!SetupTarget(req, root)) {
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    const cJSON *duration = cJSON_GetObjectItem(root, "duration");
+    const uint32_t durationMs = cJSON_IsNumber(duration)? duration->valuedouble * 1e3: 10000;
+
+    cJSON_Delete(root);
+
+    ESP_LOGI(REST_TAG, "Monitoring");
+    StatsMonitor(pin, durationMs);
+
+    return SendStats(req);
+}
+
+static esp_err_t stats_get_handler(httpd_req_t *req)
+{
+    return SendStats(req);
+}
+
+static esp_err_t stats_delete_handler(httpd_req_t *req)
+{
+    StatsReset();
+    return SendStats(req);
+}
+
+/* Handler for the validator self test, runs the fault combinations of the software DUT */
+static esp_err_t selftest_post_handler(httpd_req_t *req)
+{
+    cJSON *root = ReceiveJSON(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+
+    const cJSON *seed = cJSON_GetObjectItem(root, "seed");
+    const uint32_t testSeed = cJSON_IsNumber(seed)? seed->valuedouble: 1;
+
+    cJSON_Delete(root);
+
+    ESP_LOGI(REST_TAG, "Running self test");
+
+    struct DCP_SelfTest_t report;
+    DUTSelfTest(testSeed, &report);
+
+    httpd_resp_set_type(req, "application/json");
+
+    root = cJSON_CreateObject();
+
+    AddToJSON(root, "Cases", report.cases);
+    AddToJSON(root, "Failed", report.failed);
+    AddToJSON(root, "Cases per Second", report.cases / (report.cycles / (double)esp_clk_cpu_freq()));
+
+    if (report.failed) {
+        cJSON *first = cJSON_CreateObject();
+        cJSON_AddItemToObject(root, "First Failure", first);
+        AddToJSON(first, "faults", report.faults);
+        AddToJSON(first, "speed", report.speed);
+        AddToJSON(first, "expected", report.expected);
+        AddToJSON(first, "reported", report.reported);
+    }
+
+    const char *result = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, result);
+    free((void *)result);
+
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+/* Handler for the session log query, keys are given in the query string */
+static esp_err_t frames_get_handler(httpd_req_t *req)
+{
+    struct DCP_LogQuery_t query = {0};
+    unsigned long max = 100;
+    char buf[64];
+    char value[16];
+
+    size_t len = httpd_req_get_url_query_len(req);
+    if (len > 0 && len < sizeof buf && httpd_req_get_url_query_str(req, buf, sizeof buf) == ESP_OK) {
+        const char keys[][4] = {"ids", "idd", "cod"};
+        uint8_t *const values[] = {&query.IDS, &query.IDD, &query.COD};
+
+        for (int i = 0; i < 3; ++i) {
+            if (httpd_query_key_value(buf, keys[i], value, sizeof value) == ESP_OK) {
+                query.keys |= LOG_IDS << i;
+                *values[i] = strtoul(value, NULL, 0);
+            }
+        }
+
+        if (httpd_query_key_value(buf, "since", value, sizeof value) == ESP_OK) {
+            query.since = strtoul(value, NULL, 0);
+        }
+
+        if (httpd_query_key_value(buf, "limit", value, sizeof value) == ESP_OK) {
+            max = strtoul(value, NULL, 0);
+        }
+    }
+
+    //no more than the log holds, and at least one record so malloc can't get 0
+    max = max < 1? 1: max > CONFIG_DCP_LOG_RECORDS? CONFIG_DCP_LOG_RECORDS: max;
+
+    struct DCP_LogRecord_t *records = malloc(max * sizeof(struct DCP_LogRecord_t));
+    if (!records) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory for the query");
+        return ESP_FAIL;
+    }
+
+    const uint16_t found = LogQuery(&query, records, max);
+
+    httpd_resp_set_type(req, "application/json");
+
+    cJSON *root = cJSON_CreateArray();
+
+    for (uint16_t i = 0; i < found; ++i) {
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddItemToArray(root, item);
+
+        AddToJSON(item, "timestamp", records[i].timestamp);
+        AddToJSON(item, "type", records[i].type);
+        AddToJSON(item, "IDS", records[i].IDS);
+        AddToJSON(item, "IDD", records[i].IDD);
+        AddToJSON(item, "COD", records[i].COD);
+        AddToJSON(item, "errors", records[i].errors);
+    }
+
+    free(records);
+
+    const char *framesResult = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, framesResult);
+    free((void *)framesResult);
+
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+static esp_err_t frames_delete_handler(httpd_req_t *req)
+{
+    LogReset();
+    httpd_resp_sendstr(req, "[]");
+    return ESP_OK;
+}
+
+/* Handler for the capture pyramid, sends one fixed size tile of the requested level */
+static esp_err_t tiles_get_handler(httpd_req_t *req)
+{
+    unsigned level = 0;
+    unsigned tile = 0;
+    char buf[32];
+    char value[8];
+
+    size_t len = httpd_req_get_url_query_len(req);
+    if (len > 0 && len < sizeof buf && httpd_req_get_url_query_str(req, buf, sizeof buf) == ESP_OK) {
+        if (httpd_query_key_value(buf, "level", value, sizeof value) == ESP_OK) {
+            level = strtoul(value, NULL, 0);
+        }
+        if (httpd_query_key_value(buf, "tile", value, sizeof value) == ESP_OK) {
+            tile = strtoul(value, NULL, 0);
+        }
+    }
+
+    uint8_t bins[PYRAMID_TILE_BINS];
+    if (level > UINT8_MAX || tile > UINT16_MAX || PyramidTile(level, tile, bins) == 0) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "no such tile");
+        return ESP_FAIL;
+    }
+
+    const struct DCP_Pyramid_t *pyramid = PyramidGet();
+    const double binUs = ((double)pyramid->binCycles * (1UL << level)) / (esp_clk_cpu_freq()/1e6);
+
+    httpd_resp_set_type(req, "application/json");
+
+    cJSON *root = cJSON_CreateObject();
+
+    AddToJSON(root, "level", level);
+    AddToJSON(root, "tile", tile);
+    AddToJSON(root, "tiles", (CONFIG_DCP_PYRAMID_BINS >> level) / PYRAMID_TILE_BINS);
+    AddToJSON(root, "binTime", binUs);
+    AddToJSON(root, "start", binUs * tile * PYRAMID_TILE_BINS);
+
+    //bit 7: high seen, bit 6: low seen, bits 5~0: edges (saturated)
+    cJSON *array = cJSON_CreateArray();
+    cJSON_AddItemToObject(root, "bins", array);
+
+    for (int i = 0; i < PYRAMID_TILE_BINS; ++i) {
+        cJSON_AddItemToArray(array, cJSON_CreateNumber(bins[i]));
+    }
+
+    const char *tileResult = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, tileResult);
+    free((void *)tileResult);
+
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+/* Reads the quantization shift of the trace from the query, 0 is lossless */
+static uint8_t TraceShift(httpd_req_t *req)
+{
+    char buf[16];
+    char value[4];
+
+    size_t len = httpd_req_get_url_query_len(req);
+    if (len > 0 && len < sizeof buf && httpd_req_get_url_query_str(req, buf, sizeof buf) == ESP_OK &&
+        httpd_query_key_value(buf, "shift", value, sizeof value) == ESP_OK) {
+        const unsigned shift = strtoul(value, NULL, 0);
+        return shift < 16? shift: 0;
+    }
+
+    return 0;
+}
+
+static bool SendTraceChunk(const uint8_t *data, const size_t size, void *ctx)
+{
+    return httpd_resp_send_chunk((httpd_req_t *)ctx, (const char *)data, size) == ESP_OK;
+}
+
+/* Handler for the compressed trace export of the last capture */
+static esp_err_t trace_get_handler(httpd_req_t *req)
+{
+    char *chunk = ((rest_server_context_t *)(req->user_ctx))->scratch;
+
+    httpd_resp_set_type(req, "application/octet-stream");
+
+    if (!TraceEncodeCapture(TraceShift(req), (uint8_t *)chunk, SCRATCH_BUFSIZE, SendTraceChunk, req)) {
+        ESP_LOGE(REST_TAG, "Trace sending failed!");
+        httpd_resp_sendstr_chunk(req, NULL);
+        return ESP_FAIL;
+    }
+
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+/* Handler storing the compressed trace of the last capture in the flash */
+static esp_err_t trace_put_handler(httpd_req_t *req)
+{
+    char filepath[FILE_PATH_MAX];
+
+    rest_server_context_t *rest_context = (rest_server_context_t *)req->user_ctx;
+    strlcpy(filepath, rest_context->base_path, sizeof(filepath));
+    strlcat(filepath, "/capture.dcpt", sizeof(filepath));
+
+    if (!TraceStore(filepath, TraceShift(req))) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store trace");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_sendstr(req, "/capture.dcpt");
+    return ESP_OK;
+}
+
+/* Read a test plan, absent step fields take the defaults of the full validation */
+static bool ParsePlan(const cJSON *json, struct DCP_TestPlan_t *plan)
+{
+    const cJSON *item;
+
+    *plan = (struct DCP_TestPlan_t){0};
+
+    if (!cJSON_IsObject(json)) {
+        return false;
+    }
+
+    item = cJSON_GetObjectItem(json, "id");
+    if (cJSON_IsString(item)) {
+        if (strlen(item->valuestring) > PLAN_ID_MAX) {
+            return false;
+        }
+        strlcpy(plan->id, item->valuestring, sizeof(plan->id));
+    }
+
+    plan->failFast = cJSON_IsTrue(cJSON_GetObjectItem(json, "failFast"));
+
+    const cJSON *tests = cJSON_GetObjectItem(json, "tests");
+    if (!cJSON_IsArray(tests) || cJSON_GetArraySize(tests) == 0 || cJSON_GetArraySize(tests) > CONFIG_DCP_PLAN_STEPS) {
+        return false;
+    }
+
+    cJSON_ArrayForEach(item, tests) {
+        const cJSON *test = cJSON_GetObjectItem(item, "test");
+        const cJSON *frames = cJSON_GetObjectItem(item, "frames");
+        const cJSON *timeout = cJSON_GetObjectItem(item, "timeout");
+        const cJSON *tolerance = cJSON_GetObjectItem(item, "tolerance");
+        const cJSON *minVIH = cJSON_GetObjectItem(item, "minVIH");
+        const cJSON *maxVIL = cJSON_GetObjectItem(item, "maxVIL");
+        const cJSON *maxEdge = cJSON_GetObjectItem(item, "maxEdge");
+
+        if (!cJSON_IsString(test)) {
+            return false;
+        }
+
+        struct DCP_TestStep_t step = {
+            .kind = PlanTestKind(test->valuestring),
+            .frames = cJSON_IsNumber(frames)? frames->valueint: CONFIG_DCP_VALIDATION_FRAMES,
+            .timeoutMs = cJSON_IsNumber(timeout)? timeout->valuedouble * 1000: 10000,
+            .tolerance = cJSON_IsNumber(tolerance)? tolerance->valuedouble: 0,
+            .adc = !cJSON_IsFalse(cJSON_GetObjectItem(item, "adc")),
+            .minVIH = cJSON_IsNumber(minVIH)? minVIH->valuedouble: 0,
+            .maxVIL = cJSON_IsNumber(maxVIL)? maxVIL->valuedouble: 0,
+            .maxEdge = cJSON_IsNumber(maxEdge)? maxEdge->valuedouble * 1e-6: 0
+        };
+
+        if (step.kind == TEST_COUNT || step.frames == 0 || step.tolerance < 0 || step.tolerance >= .5) {
+            return false;
+        }
+
+        plan->step[plan->steps++] = step;
+    }
+
+    return true;
+}
+
+/* Plan id from the query string, empty if absent */
+static void PlanId(httpd_req_t *req, char id[PLAN_ID_MAX + 1])
+{
+    char buf[64];
+
+    id[0] = '\0';
+
+    size_t len = httpd_req_get_url_query_len(req);
+    if (len > 0 && len < sizeof buf && httpd_req_get_url_query_str(req, buf, sizeof buf) == ESP_OK) {
+        httpd_query_key_value(buf, "id", id, PLAN_ID_MAX + 1);
+    }
+}
+
+/* Handler storing a test plan for later runs */
+static esp_err_t plan_put_handler(httpd_req_t *req)
+{
+    cJSON *root = ReceiveJSON(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+
+    struct DCP_TestPlan_t plan;
+    const bool valid = ParsePlan(root, &plan);
+    cJSON_Delete(root);
+
+    if (!valid || plan.id[0] == '\0') {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid plan");
+        return ESP_FAIL;
+    }
+
+    if (!PlanSave(&plan)) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "plan store full");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_sendstr(req, plan.id);
+    return ESP_OK;
+}
+
+static esp_err_t plan_delete_handler(httpd_req_t *req)
+{
+    char id[PLAN_ID_MAX + 1];
+    PlanId(req, id);
+
+    if (!PlanDelete(id)) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "no such plan");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_sendstr(req, id);
+    return ESP_OK;
+}
+
+/* Sends one JSON object as a line of the streamed response */
+static bool SendLine(httpd_req_t *req, cJSON *line)
+{
+    char *text = cJSON_PrintUnformatted(line);
+    cJSON_Delete(line);
+
+    if (!text) {
+        return false;
+    }
+
+    const bool sent = httpd_resp_send_chunk(req, text, strlen(text)) == ESP_OK && httpd_resp_send_chunk(req, "\n", 1) == ESP_OK;
+    free(text);
+
+    return sent;
+}
+
+static bool SendPlanResult(const struct DCP_TestStep_t *step, const struct DCP_TestResult_t *result, void *ctx)
+{
+    cJSON *line = cJSON_CreateObject();
+
+    AddToJSON(line, "step", result->index);
+    cJSON_AddItemToObject(line, "test", cJSON_CreateString(PlanTestName(step->kind)));
+    cJSON_AddItemToObject(line, "passed", cJSON_CreateBool(result->passed));
+    AddToJSON(line, "duration", result->durationMs);
+
+    const struct DCP_Validation_t *validation = &result->validation;
+
+    switch(step->kind){
+        case TEST_traffic:
+            AddToJSON(line, "frames", validation->frames);
+            AddToJSON(line, "errors", validation->transmission.errors);
+            AddToJSON(line, "type", validation->transmission.type);
+            AddToJSON(line, "speed", validation->timings.speed);
+            AddToJSON(line, "sync", validation->timings.sync);
+            AddToJSON(line, "bit0", validation->timings.bit0);
+            AddToJSON(line, "bit1", validation->timings.bit1);
+            /* fall through */
+        case TEST_electrical:
+            AddToJSON(line, "VIH", validation->electrical.VIH);
+            AddToJSON(line, "VIL", validation->electrical.VIL);
+            AddToJSON(line, "rise", validation->electrical.rise * 1e6);
+            AddToJSON(line, "fall", validation->electrical.falling * 1e6);
+            break;
+        case TEST_yield:
+            cJSON_AddItemToObject(line, "yield", result->yield == COL_null? cJSON_CreateNull(): cJSON_CreateBool(result->yield == COL_false));
+            break;
+        default:
+            break;
+    }
+
+    return SendLine((httpd_req_t *)ctx, line);
+}
+
+/* Handler running a stored plan (?id=) or the one in the body, one JSON line per step */
+static esp_err_t plan_post_handler(httpd_req_t *req)
+{
+    cJSON *root = ReceiveJSON(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+
+    static struct DCP_TestPlan_t inline_plan;
+    const struct DCP_TestPlan_t *plan = NULL;
+    const cJSON *body_plan = cJSON_GetObjectItem(root, "plan");
+    char id[PLAN_ID_MAX + 1];
+    PlanId(req, id);
+
+    if (body_plan) {
+        plan = ParsePlan(body_plan, &inline_plan)? &inline_plan: NULL;
+    } else {
+        plan = PlanFind(id);
+    }
+
+    if (!plan) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "no valid plan");
+        return ESP_FAIL;
+    }
+
+    const gpio_num_t pin = 1;
+
+    if (!SetupTarget(req, root)) {
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    cJSON_Delete(root);
+
+    ESP_LOGI(REST_TAG, "Running plan %s, %u steps", plan->id, plan->steps);
+
+    httpd_resp_set_type(req, "application/x-ndjson");
+
+    struct DCP_PlanSummary_t summary;
+    PlanRun(pin, plan, SendPlanResult, req, &summary);
+
+    cJSON *line = cJSON_CreateObject();
+    AddToJSON(line, "run", summary.run);
+    AddToJSON(line, "failed", summary.failed);
+    cJSON_AddItemToObject(line, "stopped", cJSON_CreateBool(summary.stopped));
+    cJSON_AddItemToObject(line, "passed", cJSON_CreateBool(summary.failed == 0 && summary.run == plan->steps));
+    AddToJSON(line, "duration", summary.durationMs);
+    SendLine(req, line);
+
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+/* Read the sweep of the request, every class is tested unless "classes" lists them */
+static bool ParseSweep(const cJSON *json, struct DCP_Sweep_t *sweep)
+{
+    const cJSON *item;
+
+    *sweep = (struct DCP_Sweep_t){
+        .classes = (1U << (ULTRA + 1)) - 1,
+        .from = TargetSpeed(),
+        .frames = CONFIG_DCP_VALIDATION_FRAMES,
+        .timeoutMs = 10000,
+        .adc = true
+    };
+
+    if (!json) {
+        return true;
+    }
+
+    const cJSON *classes = cJSON_GetObjectItem(json, "classes");
+    if (cJSON_IsArray(classes)) {
+        sweep->classes = 0;
+
+        cJSON_ArrayForEach(item, classes) {
+            enum DCP_Speed_e speed = SLOW;
+            while (speed <= ULTRA && (!cJSON_IsNumber(item) || SweepSpeedCode(speed) != item->valueint)) {
+                ++speed;
+            }
+
+            if (speed > ULTRA) {
+                return false;
+            }
+
+            sweep->classes |= 1U << speed;
+        }
+    }
+
+    const cJSON *command = cJSON_GetObjectItem(json, "command");
+    if (cJSON_IsObject(command)) {
+        const cJSON *IDS = cJSON_GetObjectItem(command, "IDS");
+        const cJSON *IDD = cJSON_GetObjectItem(command, "IDD");
+        const cJSON *COD = cJSON_GetObjectItem(command, "COD");
+
+        if (!cJSON_IsNumber(IDD) || !cJSON_IsNumber(COD)) {
+            return false;
+        }
+
+        sweep->command = true;
+        sweep->IDS = cJSON_IsNumber(IDS)? IDS->valueint: 0x01;
+        sweep->IDD = IDD->valueint;
+        sweep->COD = COD->valueint;
+    }
+
+    //a commanded DUT only needs to settle, one changing by itself may take a while
+    item = cJSON_GetObjectItem(json, "settle");
+    sweep->settleMs = cJSON_IsNumber(item)? item->valuedouble * 1000: (sweep->command? 100: 30000);
+
+    item = cJSON_GetObjectItem(json, "frames");
+    if (cJSON_IsNumber(item) && item->valueint > 0) {
+        sweep->frames = item->valueint;
+    }
+
+    item = cJSON_GetObjectItem(json, "timeout");
+    if (cJSON_IsNumber(item)) {
+        sweep->timeoutMs = item->valuedouble * 1000;
+    }
+
+    sweep->adc = !cJSON_IsFalse(cJSON_GetObjectItem(json, "adc"));
+
+    return true;
+}
+
+/* Handler validating every speed class of the DUT in one request */
+static esp_err_t sweep_post_handler(httpd_req_t *req)
+{
+    cJSON *root = ReceiveJSON(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+
+    const gpio_num_t pin = 1;
+
+    if (!SetupTarget(req, root)) {
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    struct DCP_Sweep_t sweep;
+    const bool valid = ParseSweep(cJSON_GetObjectItem(root, "sweep"), &sweep);
+    cJSON_Delete(root);
+
+    if (!valid) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid sweep");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(REST_TAG, "Sweeping speed classes 0x%X", sweep.classes);
+
+    static struct DCP_SweepResult_t results[ULTRA + 1];
+    ValidateSweep(pin, &sweep, results);
+
+    httpd_resp_set_type(req, "application/json");
+
+    root = cJSON_CreateObject();
+    cJSON *classes = cJSON_CreateArray();
+    cJSON_AddItemToObject(root, "classes", classes);
+
+    bool passed = true;
+
+    for (enum DCP_Speed_e speed = SLOW; speed <= ULTRA; ++speed) {
+        const struct DCP_SweepResult_t *result = &results[speed];
+
+        if (!result->tested) {
+            continue;
+        }
+
+        passed &= result->passed;
+
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddItemToArray(classes, item);
+
+        AddToJSON(item, "Speed Class", SweepSpeedCode(speed));
+        cJSON_AddItemToObject(item, "switched", cJSON_CreateBool(result->switched));
+        cJSON_AddItemToObject(item, "passed", cJSON_CreateBool(result->passed));
+        AddToJSON(item, "duration", result->durationMs);
+        AddToJSON(item, "Frames", result->validation.frames);
+        AddToJSON(item, "Errors", result->validation.transmission.errors);
+        AddToJSON(item, "Measured Class", result->validation.timings.speed);
+        AddToJSON(item, "Sync Time", result->validation.timings.sync);
+        AddToJSON(item, "Bit Sync High", result->validation.timings.bitSync_high);
+        AddToJSON(item, "Bit Sync Low", result->validation.timings.bitSync_low);
+        AddToJSON(item, "Bit High Time", result->validation.timings.bit1);
+        AddToJSON(item, "Bit Low Time", result->validation.timings.bit0);
+        AddToJSON(item, "VIH", result->validation.electrical.VIH);
+        AddToJSON(item, "VIL", result->validation.electrical.VIL);
+        AddToJSON(item, "Rise Time", result->validation.electrical.rise * 1e6);
+        AddToJSON(item, "Falling Time", result->validation.electrical.falling * 1e6);
+    }
+
+    cJSON_AddItemToObject(root, "passed", cJSON_CreateBool(passed));
+
+    const char *report = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, report);
+    free((void *)report);
+
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+/* Read the margin search of the request, the DUT address of the request is the one answering */
+static bool ParseMargin(const cJSON *json, struct DCP_MarginSearch_t *search)
+{
+    const cJSON *item;
+
+    *search = (struct DCP_MarginSearch_t){
+        .speed = TargetSpeed(),
+        .params = (1U << MARGIN_COUNT) - 1,
+        .IDS = 0x01,
+        .IDD = TargetAddress(),
+        .resolution = .02,
+        .attempts = 2,
+        .responseMs = 100
+    };
+
+    const cJSON *params = cJSON_GetObjectItem(json, "params");
+    if (cJSON_IsArray(params)) {
+        search->params = 0;
+
+        cJSON_ArrayForEach(item, params) {
+            enum DCP_MarginParam_e param = MARGIN_sync;
+            while (param < MARGIN_COUNT && (!cJSON_IsString(item) || strcmp(item->valuestring, MarginParamName(param)) != 0)) {
+                ++param;
+            }
+
+            if (param == MARGIN_COUNT) {
+                return false;
+            }
+
+            search->params |= 1U << param;
+        }
+    }
+
+    item = cJSON_GetObjectItem(json, "COD");
+    if (!cJSON_IsNumber(item)) {
+        return false;
+    }
+    search->COD = item->valueint;
+
+    item = cJSON_GetObjectItem(json, "IDS");
+    if (cJSON_IsNumber(item)) {
+        search->IDS = item->valueint;
+    }
+
+    item = cJSON_GetObjectItem(json, "resolution");
+    if (cJSON_IsNumber(item) && item->valuedouble > 0) {
+        search->resolution = item->valuedouble;
+    }
+
+    item = cJSON_GetObjectItem(json, "attempts");
+    if (cJSON_IsNumber(item) && item->valueint > 0) {
+        search->attempts = item->valueint < UINT8_MAX? item->valueint: UINT8_MAX;
+    }
+
+    item = cJSON_GetObjectItem(json, "response");
+    if (cJSON_IsNumber(item)) {
+        search->responseMs = item->valuedouble * 1000;
+    }
+
+    //the answers are told apart by their source
+    return search->IDD != 0;
+}
+
+/* Handler for the receiver margin search on the DUT */
+static esp_err_t margin_post_handler(httpd_req_t *req)
+{
+    cJSON *root = ReceiveJSON(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+
+    const gpio_num_t pin = 1;
+
+    if (!SetupTarget(req, root)) {
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    struct DCP_MarginSearch_t search;
+    const bool valid = ParseMargin(cJSON_GetObjectItem(root, "margin"), &search);
+    cJSON_Delete(root);
+
+    if (!valid) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid margin search, deviceAddress and COD are needed");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(REST_TAG, "Searching the receiver margin of 0x%02X", search.IDD);
+
+    struct DCP_MarginReport_t report;
+    MarginSearch(pin, &search, &report);
+
+    httpd_resp_set_type(req, "application/json");
+
+    root = cJSON_CreateObject();
+    cJSON_AddItemToObject(root, "answered", cJSON_CreateBool(report.answered));
+    AddToJSON(root, "frames", report.frames);
+    AddToJSON(root, "duration", report.durationMs);
+
+    cJSON *params = cJSON_CreateObject();
+    cJSON_AddItemToObject(root, "params", params);
+
+    for (enum DCP_MarginParam_e param = MARGIN_sync; param < MARGIN_COUNT; ++param) {
+        const struct DCP_Margin_t *margin = &report.param[param];
+
+        if (!margin->searched) {
+            continue;
+        }
+
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddItemToObject(params, MarginParamName(param), item);
+
+        AddToJSON(item, "nominal", margin->nominal);
+        AddToJSON(item, "min", margin->low * margin->nominal);
+        AddToJSON(item, "max", margin->high * margin->nominal);
+        AddToJSON(item, "low", margin->low);
+        AddToJSON(item, "high", margin->high);
+        cJSON_AddItemToObject(item, "lowBounded", cJSON_CreateBool(margin->lowBounded));
+        cJSON_AddItemToObject(item, "highBounded", cJSON_CreateBool(margin->highBounded));
+    }
+
+    const char *result = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, result);
+    free((void *)result);
+
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+/* Read the fuzzing run of the request, the cases go to the DUT address of the request */
+static bool ParseFuzz(const cJSON *json, struct DCP_Fuzz_t *fuzz)
+{
+    const cJSON *item;
+
+    *fuzz = (struct DCP_Fuzz_t){
+        .seed = 1,
+        .cases = 1000,
+        .IDS = 0x01,
+        .IDD = TargetAddress(),
+        .windowMs = 5,
+        .responseMs = 100
+    };
+
+    item = cJSON_GetObjectItem(json, "seed");
+    if (cJSON_IsNumber(item)) {
+        fuzz->seed = item->valuedouble;
+    }
+
+    //a single case, seed is the one reported with the failure
+    item = cJSON_GetObjectItem(json, "replay");
+    if (cJSON_IsNumber(item)) {
+        fuzz->seed = item->valuedouble;
+        fuzz->replay = true;
+    }
+
+    item = cJSON_GetObjectItem(json, "cases");
+    if (cJSON_IsNumber(item)) {
+        fuzz->cases = item->valuedouble;
+    }
+
+    item = cJSON_GetObjectItem(json, "duration");
+    if (cJSON_IsNumber(item)) {
+        fuzz->durationMs = item->valuedouble * 1000;
+    }
+
+    item = cJSON_GetObjectItem(json, "IDS");
+    if (cJSON_IsNumber(item)) {
+        fuzz->IDS = item->valueint;
+    }
+
+    item = cJSON_GetObjectItem(json, "window");
+    if (cJSON_IsNumber(item)) {
+        fuzz->windowMs = item->valuedouble * 1000;
+    }
+
+    item = cJSON_GetObjectItem(json, "response");
+    if (cJSON_IsNumber(item)) {
+        fuzz->responseMs = item->valuedouble * 1000;
+    }
+
+    //the liveness check needs a command the DUT answers to
+    item = cJSON_GetObjectItem(json, "COD");
+    if (cJSON_IsNumber(item)) {
+        fuzz->pingCOD = item->valueint;
+        fuzz->pingEvery = 64;
+
+        item = cJSON_GetObjectItem(json, "pingEvery");
+        if (cJSON_IsNumber(item)) {
+            fuzz->pingEvery = item->valueint;
+        }
+    }
+
+    //a run without limits never ends
+    return fuzz->IDD != 0 && (fuzz->replay || fuzz->cases || fuzz->durationMs);
+}
+
+/* Handler for the protocol fuzzing of the DUT, only the failing cases are reported */
+static esp_err_t fuzz_post_handler(httpd_req_t *req)
+{
+    cJSON *root = ReceiveJSON(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+
+    const gpio_num_t pin = 1;
+
+    if (!SetupTarget(req, root)) {
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    struct DCP_Fuzz_t fuzz;
+    const bool valid = ParseFuzz(cJSON_GetObjectItem(root, "fuzz"), &fuzz);
+    cJSON_Delete(root);
+
+    if (!valid) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid fuzzing run, deviceAddress and cases or duration are needed");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(REST_TAG, "Fuzzing 0x%02X with seed 0x%08lX", fuzz.IDD, fuzz.seed);
+
+    static struct DCP_FuzzReport_t report;
+    Fuzz(pin, &fuzz, &report);
+
+    httpd_resp_set_type(req, "application/json");
+
+    root = cJSON_CreateObject();
+    AddToJSON(root, "cases", report.cases);
+    AddToJSON(root, "collisions", report.collisions);
+    AddToJSON(root, "duration", report.durationMs);
+    AddToJSON(root, "Cases per Second", report.durationMs? report.cases * 1000. / report.durationMs: 0);
+    cJSON_AddItemToObject(root, "aborted", cJSON_CreateBool(report.aborted));
+
+    for (enum DCP_FuzzFailure_e kind = FUZZ_spurious; kind < FUZZ_FAILURE_COUNT; ++kind) {
+        AddToJSON(root, FuzzFailureName(kind), report.failures[kind]);
+    }
+
+    cJSON *failures = cJSON_CreateArray();
+    cJSON_AddItemToObject(root, "failures", failures);
+
+    for (uint16_t i = 0; i < report.kept; ++i) {
+        const struct DCP_FuzzFailure_t *failure = &report.failure[i];
+
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddItemToArray(failures, item);
+
+        cJSON_AddItemToObject(item, "kind", cJSON_CreateString(FuzzFailureName(failure->kind)));
+        AddToJSON(item, "case", failure->index);
+        //a float would round the seed
+        cJSON_AddItemToObject(item, "seed", cJSON_CreateNumber(failure->seed));
+        AddToJSON(item, "mutations", failure->mutations);
+        if (failure->kind == FUZZ_hang) {
+            AddToJSON(item, "since", failure->since);
+        }
+    }
+
+    const char *result = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, result);
+    free((void *)result);
+
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+/* Read the latency test of the request, the requests go to the DUT address of the request */
+static bool ParseLatency(const cJSON *json, struct DCP_LatencyTest_t *test)
+{
+    const cJSON *item;
+
+    *test = (struct DCP_LatencyTest_t){
+        .IDS = 0x01,
+        .IDD = TargetAddress(),
+        .requests = 100,
+        .responseMs = 100,
+        .intervalMs = 10
+    };
+
+    item = cJSON_GetObjectItem(json, "COD");
+    if (!cJSON_IsNumber(item)) {
+        return false;
+    }
+    test->COD = item->valueint;
+
+    const cJSON *data = cJSON_GetObjectItem(json, "data");
+    if (cJSON_IsArray(data)) {
+        if (cJSON_GetArraySize(data) > sizeof(test->data)) {
+            return false;
+        }
+
+        int i = 0;
+        cJSON_ArrayForEach(item, data) {
+            test->data[i++] = item->valueint;
+        }
+    }
+
+    item = cJSON_GetObjectItem(json, "IDS");
+    if (cJSON_IsNumber(item)) {
+        test->IDS = item->valueint;
+    }
+
+    item = cJSON_GetObjectItem(json, "requests");
+    if (cJSON_IsNumber(item) && item->valueint > 0) {
+        test->requests = item->valueint;
+    }
+
+    item = cJSON_GetObjectItem(json, "response");
+    if (cJSON_IsNumber(item)) {
+        test->responseMs = item->valuedouble * 1000;
+    }
+
+    item = cJSON_GetObjectItem(json, "interval");
+    if (cJSON_IsNumber(item)) {
+        test->intervalMs = item->valuedouble * 1000;
+    }
+
+    //the answers are told apart by their source
+    return test->IDD != 0;
+}
+
+/* Handler for the round trip latency test of the DUT */
+static esp_err_t latency_post_handler(httpd_req_t *req)
+{
+    cJSON *root = ReceiveJSON(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+
+    const gpio_num_t pin = 1;
+
+    if (!SetupTarget(req, root)) {
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    struct DCP_LatencyTest_t test;
+    const bool valid = ParseLatency(cJSON_GetObjectItem(root, "latency"), &test);
+    cJSON_Delete(root);
+
+    if (!valid) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid latency test, deviceAddress and COD are needed");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(REST_TAG, "Timing the answers of 0x%02X", test.IDD);
+
+    struct DCP_LatencyReport_t report;
+    LatencyTest(pin, &test, &report);
+
+    httpd_resp_set_type(req, "application/json");
+
+    root = cJSON_CreateObject();
+    AddToJSON(root, "sent", report.sent);
+    AddToJSON(root, "answered", report.answered);
+    AddToJSON(root, "missed", report.missed);
+    AddToJSON(root, "corrupted", report.corrupted);
+    AddToJSON(root, "collisions", report.collisions);
+    AddToJSON(root, "duration", report.durationMs);
+
+    if (report.answered) {
+        AddToJSON(root, "min", report.min);
+        AddToJSON(root, "p50", report.p50);
+        AddToJSON(root, "p99", report.p99);
+        AddToJSON(root, "max", report.max);
+        AddToJSON(root, "mean", report.mean);
+        AddToJSON(root, "binWidth", report.binWidth);
+
+        cJSON *bins = cJSON_CreateArray();
+        cJSON_AddItemToObject(root, "bins", bins);
+
+        for (int i = 0; i < LATENCY_BINS; ++i) {
+            cJSON_AddItemToArray(bins, cJSON_CreateNumber(report.bins[i]));
+        }
+    }
+
+    const char *result = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, result);
+    free((void *)result);
+
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+/* Read the load test of the request, the frames go to the DUT address of the request */
+static bool ParseCapacity(const cJSON *json, struct DCP_CapacityTest_t *test)
+{
+    const cJSON *item;
+
+    *test = (struct DCP_CapacityTest_t){
+        .IDS = 0x01,
+        .IDD = TargetAddress(),
+        .startRate = 10,
+        .factor = 2,
+        .maxRate = 5000,
+        .frames = 100,
+        .threshold = .99,
+        .burstFrames = 32,
+        .burstMs = 1000
+    };
+
+    item = cJSON_GetObjectItem(json, "COD");
+    if (!cJSON_IsNumber(item)) {
+        return false;
+    }
+    test->COD = item->valueint;
+
+    item = cJSON_GetObjectItem(json, "IDS");
+    if (cJSON_IsNumber(item)) {
+        test->IDS = item->valueint;
+    }
+
+    test->echo = cJSON_IsTrue(cJSON_GetObjectItem(json, "echo"));
+
+    item = cJSON_GetObjectItem(json, "startRate");
+    if (cJSON_IsNumber(item) && item->valuedouble > 0) {
+        test->startRate = item->valuedouble;
+    }
+
+    item = cJSON_GetObjectItem(json, "factor");
+    if (cJSON_IsNumber(item)) {
+        test->factor = item->valuedouble;
+    }
+
+    item = cJSON_GetObjectItem(json, "maxRate");
+    if (cJSON_IsNumber(item)) {
+        test->maxRate = item->valuedouble;
+    }
+
+    item = cJSON_GetObjectItem(json, "frames");
+    if (cJSON_IsNumber(item) && item->valueint > 0) {
+        test->frames = item->valueint;
+    }
+
+    item = cJSON_GetObjectItem(json, "threshold");
+    if (cJSON_IsNumber(item)) {
+        test->threshold = item->valuedouble;
+    }
+
+    const cJSON *burst = cJSON_GetObjectItem(json, "burst");
+    if (cJSON_IsObject(burst)) {
+        item = cJSON_GetObjectItem(burst, "COD");
+        if (!cJSON_IsNumber(item)) {
+            return false;
+        }
+        test->burstCOD = item->valueint;
+        test->burst = true;
+
+        item = cJSON_GetObjectItem(burst, "frames");
+        if (cJSON_IsNumber(item) && item->valueint > 0) {
+            test->burstFrames = item->valueint;
+        }
+
+        item = cJSON_GetObjectItem(burst, "timeout");
+        if (cJSON_IsNumber(item)) {
+            test->burstMs = item->valuedouble * 1000;
+        }
+    }
+
+    //a factor of 1 or less would never reach the top rate
+    return test->IDD != 0 && test->factor > 1;
+}
+
+/* Handler for the throughput and receive capacity test of the DUT */
+static esp_err_t capacity_post_handler(httpd_req_t *req)
+{
+    cJSON *root = ReceiveJSON(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+
+    const gpio_num_t pin = 1;
+
+    if (!SetupTarget(req, root)) {
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    struct DCP_CapacityTest_t test;
+    const bool valid = ParseCapacity(cJSON_GetObjectItem(root, "capacity"), &test);
+    cJSON_Delete(root);
+
+    if (!valid) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid capacity test, deviceAddress and COD are needed");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(REST_TAG, "Loading 0x%02X from %.0f to %.0f frames/s", test.IDD, test.startRate, test.maxRate);
+
+    struct DCP_CapacityReport_t report;
+    CapacityTest(pin, &test, &report);
+
+    httpd_resp_set_type(req, "application/json");
+
+    root = cJSON_CreateObject();
+    AddToJSON(root, "capacity", report.capacity);
+    cJSON_AddItemToObject(root, "saturated", cJSON_CreateBool(report.saturated));
+    AddToJSON(root, "duration", report.durationMs);
+
+    cJSON *curve = cJSON_CreateArray();
+    cJSON_AddItemToObject(root, "curve", curve);
+
+    for (uint8_t i = 0; i < report.steps; ++i) {
+        const struct DCP_CapacityStep_t *step = &report.step[i];
+
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddItemToArray(curve, item);
+
+        AddToJSON(item, "rate", step->rate);
+        AddToJSON(item, "achieved", step->achieved);
+        AddToJSON(item, "sent", step->sent);
+        AddToJSON(item, "acknowledged", step->acknowledged);
+        AddToJSON(item, "collisions", step->collisions);
+    }
+
+    if (test.burst) {
+        cJSON *burst = cJSON_CreateObject();
+        cJSON_AddItemToObject(root, "burst", burst);
+
+        AddToJSON(burst, "received", report.burstReceived);
+        AddToJSON(burst, "errors", report.burstErrors);
+        AddToJSON(burst, "Frames per Second", report.burstRate);
+        AddToJSON(burst, "Bytes per Second", report.burstBytes);
+    }
+
+    const char *result = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, result);
+    free((void *)result);
+
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+/* Read the virtual nodes of the request, the DUT address of the request is the one judged */
+static bool ParseMultiNode(const cJSON *json, struct DCP_MultiNode_t *test)
+{
+    const cJSON *item;
+
+    *test = (struct DCP_MultiNode_t){
+        .DUT = TargetAddress(),
+        .durationMs = 10000,
+        .seed = 1
+    };
+
+    item = cJSON_GetObjectItem(json, "duration");
+    if (cJSON_IsNumber(item)) {
+        test->durationMs = item->valuedouble * 1000;
+    }
+
+    item = cJSON_GetObjectItem(json, "seed");
+    if (cJSON_IsNumber(item)) {
+        test->seed = item->valuedouble;
+    }
+
+    const cJSON *nodes = cJSON_GetObjectItem(json, "nodes");
+    if (!cJSON_IsArray(nodes) || cJSON_GetArraySize(nodes) == 0 || cJSON_GetArraySize(nodes) > MULTINODE_MAX) {
+        return false;
+    }
+
+    const cJSON *entry;
+    cJSON_ArrayForEach(entry, nodes) {
+        struct DCP_VirtualNode_t *node = &test->node[test->nodes++];
+
+        *node = (struct DCP_VirtualNode_t){
+            .IDD = test->DUT,
+            .periodMs = 100,
+            .burst = 1
+        };
+
+        item = cJSON_GetObjectItem(entry, "address");
+        if (!cJSON_IsNumber(item) || item->valueint == test->DUT) {
+            return false;
+        }
+        node->addr = item->valueint;
+
+        item = cJSON_GetObjectItem(entry, "IDD");
+        if (cJSON_IsNumber(item)) {
+            node->IDD = item->valueint;
+        }
+
+        //generic frames carry at least their address
+        item = cJSON_GetObjectItem(entry, "size");
+        if (cJSON_IsNumber(item)) {
+            if (item->valueint != 0 && (item->valueint < 2 || item->valueint >= CAPTURE_FRAME_MAX)) {
+                return false;
+            }
+            node->size = item->valueint;
+        }
+
+        //the schedule works in whole ms, a shorter period would never move on
+        item = cJSON_GetObjectItem(entry, "period");
+        if (cJSON_IsNumber(item)) {
+            node->periodMs = item->valuedouble * 1000;
+
+            if (node->periodMs == 0) {
+                return false;
+            }
+        }
+
+        item = cJSON_GetObjectItem(entry, "burst");
+        if (cJSON_IsNumber(item) && item->valueint > 0) {
+            node->burst = item->valueint;
+        }
+    }
+
+    return test->DUT != 0;
+}
+
+/* Handler for the arbitration test of the DUT against virtual nodes */
+static esp_err_t nodes_post_handler(httpd_req_t *req)
+{
+    cJSON *root = ReceiveJSON(req);
+    if (!root) {
+        return ESP_FAIL;
+    }
+
+    const gpio_num_t pin = 1;
+
+    if (!SetupTarget(req, root)) {
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    struct DCP_MultiNode_t test;
+    const bool valid = ParseMultiNode(cJSON_GetObjectItem(root, "emulation"), &test);
+    cJSON_Delete(root);
+
+    if (!valid) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid emulation, deviceAddress and 1 to 8 nodes with other addresses and periods of 1ms or more are needed");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(REST_TAG, "Emulating %u nodes around 0x%02X", test.nodes, test.DUT);
+
+    struct DCP_MultiNodeReport_t report;
+    MultiNodeTest(pin, &test, &report);
+
+    httpd_resp_set_type(req, "application/json");
+
+    root = cJSON_CreateObject();
+    cJSON_AddItemToObject(root, "passed", cJSON_CreateBool(report.passed));
+    AddToJSON(root, "duration", report.durationMs);
+    AddToJSON(root, "DUT Frames", report.dutFrames);
+    AddToJSON(root, "DUT Corrupted", report.dutCorrupted);
+    AddToJSON(root, "Contended", report.contended);
+    AddToJSON(root, "Contended Corrupted", report.contendedCorrupted);
+
+    cJSON *nodes = cJSON_CreateArray();
+    cJSON_AddItemToObject(root, "nodes", nodes);
+
+    for (uint8_t i = 0; i < test.nodes; ++i) {
+        const struct DCP_NodeResult_t *result = &report.node[i];
+
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddItemToArray(nodes, item);
+
+        AddToJSON(item, "address", test.node[i].addr);
+        cJSON_AddItemToObject(item, "outranks", cJSON_CreateBool(test.node[i].addr < test.DUT));
+        AddToJSON(item, "sent", result->sent);
+        AddToJSON(item, "deferred", result->deferred);
+        AddToJSON(item, "lost", result->lost);
+        AddToJSON(item, "violations", result->violations);
+        AddToJSON(item, "pending", result->pending);
+    }
+
+    const char *result = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, result);
+    free((void *)result);
+
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+esp_err_t start_rest_server(const char *base_path)
+{
+    REST_CHECK(base_path, "wrong base path", err);
+    rest_server_context_t *rest_context = calloc(1, sizeof(rest_server_context_t));
+    REST_CHECK(rest_context, "No memory for rest context", err);
+    strlcpy(rest_context->base_path, base_path, sizeof(rest_context->base_path));
+
+    httpd_handle_t server = NULL;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.uri_match_fn = httpd_uri_match_wildcard;
+    config.max_uri_handlers = 24;
+
+    ESP_LOGI(REST_TAG, "Starting HTTP Server");
+    REST_CHECK(httpd_start(&server, &config) == ESP_OK, "Start server failed", err_start);
+
+    /* URI handler for fetching system info */
+    httpd_uri_t system_info_get_uri = {
+        .uri = "/api/v1/validation",
+        .method = HTTP_POST,
+        .handler = system_info_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &system_info_get_uri);
+
+    /* URI handler for the triggered capture */
+    httpd_uri_t capture_post_uri = {
+        .uri = "/api/v1/capture",
+        .method = HTTP_POST,
+        .handler = capture_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &capture_post_uri);
+
+    httpd_uri_t tiles_get_uri = {
+        .uri = "/api/v1/capture/tiles",
+        .method = HTTP_GET,
+        .handler = tiles_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &tiles_get_uri);
+
+    /* URI handlers for the compressed trace, the stored one is served as a file */
+    httpd_uri_t trace_get_uri = {
+        .uri = "/api/v1/capture/trace",
+        .method = HTTP_GET,
+        .handler = trace_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &trace_get_uri);
+
+    httpd_uri_t trace_put_uri = {
+        .uri = "/api/v1/capture/trace",
+        .method = HTTP_PUT,
+        .handler = trace_put_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &trace_put_uri);
+
+    /* URI handlers for the test plans */
+    httpd_uri_t plan_put_uri = {
+        .uri = "/api/v1/plan",
+        .method = HTTP_PUT,
+        .handler = plan_put_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &plan_put_uri);
+
+    httpd_uri_t plan_post_uri = {
+        .uri = "/api/v1/plan",
+        .method = HTTP_POST,
+        .handler = plan_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &plan_post_uri);
+
+    httpd_uri_t plan_delete_uri = {
+        .uri = "/api/v1/plan",
+        .method = HTTP_DELETE,
+        .handler = plan_delete_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &plan_delete_uri);
+
+    /* URI handler for the speed class sweep */
+    httpd_uri_t sweep_post_uri = {
+        .uri = "/api/v1/sweep",
+        .method = HTTP_POST,
+        .handler = sweep_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &sweep_post_uri);
+
+    /* URI handler for the receiver margin search */
+    httpd_uri_t margin_post_uri = {
+        .uri = "/api/v1/margin",
+        .method = HTTP_POST,
+        .handler = margin_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &margin_post_uri);
+
+    /* URI handler for the protocol fuzzer */
+    httpd_uri_t fuzz_post_uri = {
+        .uri = "/api/v1/fuzz",
+        .method = HTTP_POST,
+        .handler = fuzz_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &fuzz_post_uri);
+
+    /* URI handler for the round trip latency test */
+    httpd_uri_t latency_post_uri = {
+        .uri = "/api/v1/latency",
+        .method = HTTP_POST,
+        .handler = latency_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &latency_post_uri);
+
+    /* URI handler for the throughput and receive capacity test */
+    httpd_uri_t capacity_post_uri = {
+        .uri = "/api/v1/capacity",
+        .method = HTTP_POST,
+        .handler = capacity_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &capacity_post_uri);
+
+    /* URI handler for the arbitration test against virtual nodes */
+    httpd_uri_t nodes_post_uri = {
+        .uri = "/api/v1/nodes",
+        .method = HTTP_POST,
+        .handler = nodes_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &nodes_post_uri);
+
+    /* URI handlers for the bus statistics */
+    httpd_uri_t monitor_post_uri = {
+        .uri = "/api/v1/monitor",
+        .method = HTTP_POST,
+        .handler = monitor_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &monitor_post_uri);
+
+    httpd_uri_t stats_get_uri = {
+        .uri = "/api/v1/stats",
+        .method = HTTP_GET,
+        .handler = stats_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &stats_get_uri);
+
+    httpd_uri_t stats_delete_uri = {
+        .uri = "/api/v1/stats",
+        .method = HTTP_DELETE,
+        .handler = stats_delete_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &stats_delete_uri);
+
+    /* URI handlers for the session log */
+    httpd_uri_t frames_get_uri = {
+        .uri = "/api/v1/frames",
+        .method = HTTP_GET,
+        .handler = frames_get_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &frames_get_uri);
+
+    httpd_uri_t frames_delete_uri = {
+        .uri = "/api/v1/frames",
+        .method = HTTP_DELETE,
+        .handler = frames_delete_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &frames_delete_uri);
+
+    /* URI handler for the validator self test */
+    httpd_uri_t selftest_post_uri = {
+        .uri = "/api/v1/selftest",
+        .method = HTTP_POST,
+        .handler = selftest_post_handler,
+        .user_ctx = rest_context
+    };
+    httpd_register_uri_handler(server, &selftest_post_uri);
 
     /* URI handler for getting web server files */
     httpd_uri_t common_get_uri = {
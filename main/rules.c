@@ -0,0 +1,100 @@
+#include "rules.h"
+#include "DCP.h"
+#include "validator.h"
+
+#include <esp_log.h>
+#include "sdkconfig.h"
+
+static const char* TAG = "Rules";
+
+//built in rules of the DCP spec, sorted by offset
+static const struct DCP_Rule_t builtinL3[] = {
+    {RULE_range,  1,  0xFF, DCP_L3_SOH, DCP_L3_SOH, ERROR_message_invalidL3_header},
+    {RULE_target, 2,  0xFF, 0,          0,          ERROR_message_invalidL3_sID},
+    {RULE_range,  11, 0xFF, DCP_L3_PAD, DCP_L3_PAD, ERROR_message_invalidL3_padding},
+    {RULE_CRC,    12, 0xFF, 0,          0,          ERROR_message_invalidL3_CRC}
+};
+
+static const struct DCP_Rule_t builtinGeneric[] = {
+    //the type byte counts itself, a generic message carries at least the address
+    {RULE_range,  0,  0xFF, 2,          0xFF,       ERROR_message_invalidGeneric}
+};
+
+static const struct {
+    const struct DCP_Rule_t* rules;
+    uint8_t count;
+} builtin[RULES_COUNT] = {
+    [RULES_L3] = {builtinL3, sizeof builtinL3 / sizeof builtinL3[0]},
+    [RULES_generic] = {builtinGeneric, sizeof builtinGeneric / sizeof builtinGeneric[0]}
+};
+
+static struct DCP_Rule_t profile[RULES_COUNT][CONFIG_DCP_PROFILE_RULES];
+static uint8_t profileCount[RULES_COUNT];
+static bool suspended;
+
+///////////////////////////////////////////////////////////////
+
+static uint32_t s_Evaluate(const struct DCP_Rule_t* rules, const uint8_t count, const uint8_t* data, const size_t size, const uint8_t target){
+
+    uint32_t errors = ERROR_none;
+
+    for (const struct DCP_Rule_t* rule = rules; rule < rules + count; ++rule){
+        if (rule->offset >= size){
+            errors |= rule->error;
+            continue;
+        }
+
+        const uint8_t value = data[rule->offset] & rule->mask;
+        bool fail;
+
+        switch(rule->kind){
+            case RULE_target:
+                fail = target != 0 && value != (target & rule->mask);
+                break;
+            case RULE_CRC:
+                fail = rule->offset == 0 || value != (DCPCRC8(&data[1], rule->offset - 1) & rule->mask);
+                break;
+            default:
+                fail = value < rule->min || value > rule->max;
+                break;
+        }
+
+        if (fail){
+            errors |= rule->error;
+        }
+    }
+
+    return errors;
+}
+
+uint32_t RulesEvaluate(const enum RuleSet_e set, const uint8_t* data, const size_t size, const uint8_t target){
+    return s_Evaluate(builtin[set].rules, builtin[set].count, data, size, target) |
+           s_Evaluate(profile[set], suspended? 0: profileCount[set], data, size, target);
+}
+
+bool RulesAdd(const enum RuleSet_e set, const struct DCP_Rule_t rule){
+
+    if (set >= RULES_COUNT || profileCount[set] >= CONFIG_DCP_PROFILE_RULES){
+        ESP_LOGE(TAG, "profile rule doesn't fit");
+        return false;
+    }
+
+    //kept sorted by offset, the frame is walked once
+    int i = profileCount[set]++;
+    for (; i > 0 && profile[set][i - 1].offset > rule.offset; --i){
+        profile[set][i] = profile[set][i - 1];
+    }
+    profile[set][i] = rule;
+
+    return true;
+}
+
+void RulesClear(void){
+    for (int i = 0; i < RULES_COUNT; ++i){
+        profileCount[i] = 0;
+    }
+}
+
+void RulesSuspend(const bool suspend){
+    suspended = suspend;
+}
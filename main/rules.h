@@ -0,0 +1,38 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+///////////////////////////////////////////////////////////////
+
+enum RuleSet_e {RULES_L3 = 0, RULES_generic, RULES_COUNT};
+
+enum RuleKind_e {
+    RULE_range = 0,     //min <= (byte & mask) <= max
+    RULE_target,        //(byte & mask) is the DUT address, skipped if unknown
+    RULE_CRC            //byte is the CRC-8 of the bytes from 1 up to it
+};
+
+struct DCP_Rule_t {
+    uint8_t kind;
+    uint8_t offset;     //from the type byte
+    uint8_t mask;
+    uint8_t min;
+    uint8_t max;
+    uint32_t error;     //DCP_Errors_e set when the rule fails or the byte is missing
+};
+
+/*!
+ * @brief evaluates every rule of the set over the frame in a single pass
+ * @param data = frame, type byte included
+ * @param target = DUT address, 0 if unknown
+ * @return DCP_Errors_e mask of the failed rules
+ */
+uint32_t RulesEvaluate(const enum RuleSet_e set, const uint8_t* data, const size_t size, const uint8_t target);
+
+//profile rules are checked after the built in ones, up to CONFIG_DCP_PROFILE_RULES
+bool RulesAdd(const enum RuleSet_e set, const struct DCP_Rule_t rule);
+void RulesClear(void);
+//the profile rules are skipped while suspended, they are kept for the resume
+void RulesSuspend(const bool suspend);
@@ -0,0 +1,110 @@
+#include "sweep.h"
+#include "DCP_internal.h"
+#include "capture.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+
+#include <string.h>
+
+static const char* TAG = "Sweep";
+
+static const uint8_t speedCodes[] = {4, 20, 32, 64};
+
+///////////////////////////////////////////////////////////////
+
+uint8_t SweepSpeedCode(const enum DCP_Speed_e speed){
+    return speedCodes[speed > ULTRA? SLOW: speed];
+}
+
+//the command goes out at the speed the DUT is still listening at
+static bool s_SendSwitch(const gpio_num_t pin, const struct DCP_Sweep_t* sweep, const enum DCP_Speed_e current, const enum DCP_Speed_e next){
+
+    DCP_Data_t frame = {.message = &(struct DCP_Message_t){0}};
+
+    frame.message->type = 0;
+    frame.message->L3.IDS = sweep->IDS;
+    frame.message->L3.IDD = sweep->IDD;
+    frame.message->L3.COD = sweep->COD;
+    frame.message->L3.data[0] = SweepSpeedCode(next);
+    frame.message->L3.PAD = DCP_L3_PAD;
+    DCPStampL3(&frame.message->L3);
+
+    uint32_t delays[4];
+    DCPFrameDelays(current, true, NULL, delays);
+
+    //a busy bus gets a few more chances
+    for (int i = 0; i < 4; ++i){
+        if (!DCPSendFrame(pin, delays, sizeof(struct DCP_Message_t), frame.data)) return true;
+
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    return false;
+}
+
+static bool s_OnFirstFrame(const struct DCP_Frame_t* frame, const uint32_t seq, void* ctx){
+    return true;
+}
+
+//watches the DUT traffic until it shows up at the speed
+static bool s_WaitForSpeed(const gpio_num_t pin, const enum DCP_Speed_e speed, const uint32_t timeoutMs){
+
+    const TickType_t begin = xTaskGetTickCount();
+    const TickType_t timeout = pdMS_TO_TICKS(timeoutMs);
+    bool found = false;
+
+    SetTargetAutoSpeed(true);
+
+    for (TickType_t elapsed = 0; !found && elapsed < timeout; elapsed = xTaskGetTickCount() - begin){
+        found = CaptureListen(pin, pdTICKS_TO_MS(timeout - elapsed), s_OnFirstFrame, NULL)
+            && TargetSpeed() == speed;
+    }
+
+    SetTargetAutoSpeed(false);
+
+    return found;
+}
+
+void ValidateSweep(const gpio_num_t pin, const struct DCP_Sweep_t* sweep, struct DCP_SweepResult_t results[ULTRA+1]){
+
+    memset(results, 0, (ULTRA+1)*sizeof(results[0]));
+
+    //the class of each capture is known, detection would only get in the way
+    const bool autoSpeed = TargetAutoSpeed();
+    enum DCP_Speed_e current = sweep->from;
+
+    for (enum DCP_Speed_e speed = SLOW; speed <= ULTRA; ++speed){
+        if (!(sweep->classes & (1U << speed))) continue;
+
+        struct DCP_SweepResult_t* const result = &results[speed];
+        const TickType_t start = xTaskGetTickCount();
+
+        result->tested = true;
+
+        if (sweep->command){
+            result->switched = current == speed || s_SendSwitch(pin, sweep, current, speed);
+            vTaskDelay(pdMS_TO_TICKS(sweep->settleMs));
+        }else{
+            result->switched = s_WaitForSpeed(pin, speed, sweep->settleMs);
+        }
+
+        SetTargetAutoSpeed(false);
+        SetTargetSpeed(speed);
+
+        if (result->switched){
+            current = speed;
+            result->passed = ValidateTraffic(pin, sweep->frames, sweep->timeoutMs, sweep->adc, &result->validation)
+                && result->validation.transmission.errors == ERROR_none;
+        }
+
+        result->durationMs = pdTICKS_TO_MS(xTaskGetTickCount() - start);
+
+        ESP_LOGI(TAG, "class %u: %s, %lu frames, errors 0x%lX, %lums", SweepSpeedCode(speed),
+                result->passed? "passed": "failed", result->validation.frames, (uint32_t)result->validation.transmission.errors, result->durationMs);
+    }
+
+    SetTargetAutoSpeed(autoSpeed);
+}
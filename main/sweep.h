@@ -0,0 +1,47 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <driver/gpio.h>
+
+#include "DCP.h"
+#include "validator.h"
+
+///////////////////////////////////////////////////////////////
+
+/*!
+ * @brief validation of every speed class of a DUT in one run
+ *
+ * the DUT is either told to change speed with an L3 command frame, whose
+ * first data byte is the class in the deviceSpeed units (4, 20, 32, 64),
+ * or given up to settleMs to change by itself while its traffic is watched
+ */
+struct DCP_Sweep_t {
+    uint8_t classes;            //bit per DCP_Speed_e
+    enum DCP_Speed_e from;      //speed of the DUT before the sweep
+    bool command;
+    uint8_t IDS;                //of the command frame
+    uint8_t IDD;
+    uint8_t COD;
+    uint32_t settleMs;
+    uint32_t frames;            //per class
+    uint32_t timeoutMs;         //per class
+    bool adc;
+};
+
+struct DCP_SweepResult_t {
+    bool tested;
+    bool switched;              //the command went out, or the DUT was seen at the class
+    bool passed;
+    uint32_t durationMs;
+    struct DCP_Validation_t validation;
+};
+
+///////////////////////////////////////////////////////////////
+
+//speed class in the deviceSpeed units
+uint8_t SweepSpeedCode(const enum DCP_Speed_e speed);
+
+//the target bus and DUT must be set up, the target timing is left at the last class
+void ValidateSweep(const gpio_num_t pin, const struct DCP_Sweep_t* sweep, struct DCP_SweepResult_t results[ULTRA+1]);
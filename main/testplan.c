@@ -0,0 +1,134 @@
+#include "testplan.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+
+#include <string.h>
+
+static const char* TAG = "TestPlan";
+
+static const char* const testNames[TEST_COUNT] = {"traffic", "electrical", "yield"};
+
+///////////////////////////////////////////////////////////////
+
+const char* PlanTestName(const enum DCP_TestKind_e kind){
+    return kind < TEST_COUNT? testNames[kind]: "unknown";
+}
+
+enum DCP_TestKind_e PlanTestKind(const char* name){
+    for (int i = 0; i < TEST_COUNT; ++i){
+        if (strcmp(name, testNames[i]) == 0) return i;
+    }
+
+    return TEST_COUNT;
+}
+
+static bool s_ElectricalPasses(const struct DCP_TestStep_t* step, const struct DCP_electrical_t* electrical){
+
+    if (step->minVIH > 0 && electrical->VIH < step->minVIH) return false;
+    if (step->maxVIL > 0 && electrical->VIL > step->maxVIL) return false;
+    if (step->maxEdge > 0 && (electrical->rise > step->maxEdge || electrical->falling > step->maxEdge)) return false;
+
+    return true;
+}
+
+static void s_RunStep(const gpio_num_t pin, const struct DCP_TestStep_t* step, struct DCP_TestResult_t* result){
+
+    switch(step->kind){
+        case TEST_traffic:
+            SetTargetTolerance(step->tolerance);
+
+            result->passed = ValidateTraffic(pin, step->frames, step->timeoutMs, step->adc, &result->validation)
+                && result->validation.transmission.errors == ERROR_none
+                && s_ElectricalPasses(step, &result->validation.electrical);
+
+            SetTargetTolerance(0);
+            break;
+        case TEST_electrical:
+            result->validation.electrical = MeasureElectrical(pin);
+            result->passed = s_ElectricalPasses(step, &result->validation.electrical);
+            break;
+        case TEST_yield:
+            result->yield = DoesYield(pin, step->timeoutMs);
+            result->passed = result->yield == COL_false;
+            break;
+        default:
+            result->passed = false;
+            break;
+    }
+}
+
+void PlanRun(const gpio_num_t pin, const struct DCP_TestPlan_t* plan, const PlanCallback_t onResult, void* ctx, struct DCP_PlanSummary_t* summary){
+
+    memset(summary, 0, sizeof(*summary));
+
+    const TickType_t begin = xTaskGetTickCount();
+
+    for (uint8_t i = 0; i < plan->steps; ++i){
+        struct DCP_TestResult_t result = {.index = i};
+        const TickType_t start = xTaskGetTickCount();
+
+        s_RunStep(pin, &plan->step[i], &result);
+
+        result.durationMs = pdTICKS_TO_MS(xTaskGetTickCount() - start);
+        summary->run++;
+        if (!result.passed) summary->failed++;
+
+        ESP_LOGI(TAG, "%s: step %u %s %s in %lums", plan->id, i, PlanTestName(plan->step[i].kind),
+                result.passed? "passed": "failed", result.durationMs);
+
+        if (!onResult(&plan->step[i], &result, ctx)) break;
+
+        if (!result.passed && plan->failFast){
+            summary->stopped = i+1 < plan->steps;
+            break;
+        }
+    }
+
+    summary->durationMs = pdTICKS_TO_MS(xTaskGetTickCount() - begin);
+}
+
+///////////////////////////////////////////////////////////////
+
+static struct DCP_TestPlan_t plans[CONFIG_DCP_PLANS];
+
+bool PlanSave(const struct DCP_TestPlan_t* plan){
+
+    struct DCP_TestPlan_t* slot = NULL;
+
+    for (int i = 0; i < CONFIG_DCP_PLANS; ++i){
+        if (strcmp(plans[i].id, plan->id) == 0){
+            slot = &plans[i];
+            break;
+        }
+
+        if (!slot && plans[i].id[0] == '\0') slot = &plans[i];
+    }
+
+    if (!slot) return false;
+
+    *slot = *plan;
+    return true;
+}
+
+const struct DCP_TestPlan_t* PlanFind(const char* id){
+
+    if (id[0] == '\0') return NULL;
+
+    for (int i = 0; i < CONFIG_DCP_PLANS; ++i){
+        if (strcmp(plans[i].id, id) == 0) return &plans[i];
+    }
+
+    return NULL;
+}
+
+bool PlanDelete(const char* id){
+    struct DCP_TestPlan_t* const plan = (struct DCP_TestPlan_t*)PlanFind(id);
+
+    if (!plan) return false;
+
+    plan->id[0] = '\0';
+    return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <driver/gpio.h>
+
+#include "validator.h"
+#include "sdkconfig.h"
+
+///////////////////////////////////////////////////////////////
+
+#define PLAN_ID_MAX 16
+
+enum DCP_TestKind_e {
+    TEST_traffic,       //electrical, timing and framing from one capture
+    TEST_electrical,    //ADC probe only
+    TEST_yield,         //the DUT must give up the bus
+    TEST_COUNT
+};
+
+/*!
+ * @brief one step of a test plan
+ *
+ * the limits left at 0 are not checked, the step then passes on
+ * the spec rules alone
+ */
+struct DCP_TestStep_t {
+    enum DCP_TestKind_e kind;
+    uint32_t frames;        //frames decoded by a traffic step
+    uint32_t timeoutMs;
+    float tolerance;        //timing margin of error, fraction of delta. 0 keeps the 2% of the bus
+    bool adc;               //traffic steps also sample the line
+    float minVIH;           //V
+    float maxVIL;           //V
+    float maxEdge;          //s, for both the rise and the fall
+};
+
+struct DCP_TestPlan_t {
+    char id[PLAN_ID_MAX+1];
+    bool failFast;          //stop at the first failed step
+    uint8_t steps;
+    struct DCP_TestStep_t step[CONFIG_DCP_PLAN_STEPS];
+};
+
+struct DCP_TestResult_t {
+    uint8_t index;          //of the step
+    bool passed;
+    uint32_t durationMs;
+    struct DCP_Validation_t validation;     //traffic and electrical steps
+    enum Collision_e yield;                 //yield steps
+};
+
+struct DCP_PlanSummary_t {
+    uint8_t run;
+    uint8_t failed;
+    bool stopped;           //fail fast skipped the rest
+    uint32_t durationMs;
+};
+
+//called after every step, returning false aborts the plan
+typedef bool (*PlanCallback_t)(const struct DCP_TestStep_t* step, const struct DCP_TestResult_t* result, void* ctx);
+
+///////////////////////////////////////////////////////////////
+
+const char* PlanTestName(const enum DCP_TestKind_e kind);
+//TEST_COUNT if the name is not a test
+enum DCP_TestKind_e PlanTestKind(const char* name);
+
+//the DUT timing must already be set up, see SetTargetSpeed
+void PlanRun(const gpio_num_t pin, const struct DCP_TestPlan_t* plan, const PlanCallback_t onResult, void* ctx, struct DCP_PlanSummary_t* summary);
+
+/*!
+ * @brief plans kept for reuse, replacing the one with the same id
+ * @return false if the store is full
+ */
+bool PlanSave(const struct DCP_TestPlan_t* plan);
+//NULL if there is no plan with that id
+const struct DCP_TestPlan_t* PlanFind(const char* id);
+bool PlanDelete(const char* id);
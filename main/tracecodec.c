@@ -0,0 +1,197 @@
+#include "tracecodec.h"
+#include "capture.h"
+
+#include <esp_private/esp_clk.h>
+#include <esp_log.h>
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* TAG = "Trace";
+
+//in delta/2, so 7.5 delta fits
+static const uint8_t symbolLUT[TRACE_SYMBOLS] = {2, 4, 15, 50, 100};
+
+///////////////////////////////////////////////////////////////
+
+static void s_Put32(uint8_t* out, const uint32_t value){
+    for (int i = 0; i < 4; ++i){
+        out[i] = value >> 8*i;
+    }
+}
+
+static uint32_t s_Get32(const uint8_t* in){
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static size_t s_PutVarint(uint8_t* out, uint64_t value){
+    size_t n = 0;
+
+    for (; value >= 0x80; value >>= 7){
+        out[n++] = (value & 0x7F) | 0x80;
+    }
+    out[n++] = value;
+
+    return n;
+}
+
+static uint64_t s_ZigZag(const int64_t value){
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t s_UnZigZag(const uint64_t value){
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+//running average of each symbol, it follows a skewed DUT without taking the jitter
+static void s_Predict(struct DCP_TraceCodec_t* codec, const int symbol, const uint32_t interval){
+    codec->predicted[symbol] = (3*codec->predicted[symbol] + interval + 2) / 4;
+}
+
+void TraceCodecInit(struct DCP_TraceCodec_t* codec, const uint32_t deltaCycles, const uint32_t freqMHz, const uint8_t shift){
+
+    codec->shift = shift;
+    codec->deltaCycles = deltaCycles;
+    codec->freqMHz = freqMHz;
+    codec->last = 0;
+    codec->started = false;
+
+    for (int i = 0; i < TRACE_SYMBOLS; ++i){
+        codec->expected[i] = ((uint64_t)deltaCycles * symbolLUT[i] / 2) >> shift;
+        codec->predicted[i] = codec->expected[i];
+    }
+}
+
+size_t TraceEncodeHeader(const struct DCP_TraceCodec_t* codec, const uint32_t edges, uint8_t out[TRACE_HEADER_SIZE]){
+
+    memcpy(out, TRACE_MAGIC, 4);
+    out[4] = TRACE_VERSION;
+    out[5] = codec->shift;
+    out[6] = 0;
+    out[7] = 0;
+    s_Put32(&out[8], codec->deltaCycles);
+    s_Put32(&out[12], codec->freqMHz);
+    s_Put32(&out[16], edges);
+
+    return TRACE_HEADER_SIZE;
+}
+
+size_t TraceEncodeEdge(struct DCP_TraceCodec_t* codec, const esp_cpu_cycle_count_t t, uint8_t out[TRACE_TOKEN_MAX]){
+
+    if (!codec->started){
+        codec->started = true;
+        codec->last = t;
+        return 0;
+    }
+
+    //timestamps are quantized, not intervals, so the error doesn't build up
+    const uint32_t interval = (t >> codec->shift) - (codec->last >> codec->shift);
+    codec->last = t;
+
+    //nearest nominal interval, it must be within half of it
+    int symbol = 0;
+    for (int i = 1; i < TRACE_SYMBOLS; ++i){
+        if (abs((int32_t)(interval - codec->expected[i])) < abs((int32_t)(interval - codec->expected[symbol]))){
+            symbol = i;
+        }
+    }
+
+    if (abs((int32_t)(interval - codec->expected[symbol])) > codec->expected[symbol] / 2){
+        return s_PutVarint(out, (uint64_t)interval << 3 | TRACE_RAW);
+    }
+
+    //delta of delta, the residual is against the running interval of the same symbol
+    const int64_t residual = (int64_t)interval - codec->predicted[symbol];
+    s_Predict(codec, symbol, interval);
+
+    return s_PutVarint(out, s_ZigZag(residual) << 3 | symbol);
+}
+
+int32_t TraceDecodeHeader(struct DCP_TraceCodec_t* codec, const uint8_t in[TRACE_HEADER_SIZE]){
+
+    if (memcmp(in, TRACE_MAGIC, 4) != 0 || in[4] != TRACE_VERSION) return -1;
+
+    TraceCodecInit(codec, s_Get32(&in[8]), s_Get32(&in[12]), in[5]);
+
+    return s_Get32(&in[16]);
+}
+
+size_t TraceDecodeInterval(struct DCP_TraceCodec_t* codec, const uint8_t* in, const size_t size, uint32_t* interval){
+
+    uint64_t value = 0;
+    size_t n = 0;
+
+    do {
+        if (n >= size || n >= TRACE_TOKEN_MAX) return 0;
+        value |= (uint64_t)(in[n] & 0x7F) << 7*n;
+    } while (in[n++] & 0x80);
+
+    const uint8_t tag = value & 0x7;
+
+    if (tag == TRACE_RAW){
+        *interval = (value >> 3) << codec->shift;
+        return n;
+    }
+
+    if (tag >= TRACE_SYMBOLS) return 0;
+
+    const uint32_t quantized = codec->predicted[tag] + s_UnZigZag(value >> 3);
+    s_Predict(codec, tag, quantized);
+    *interval = quantized << codec->shift;
+
+    return n;
+}
+
+///////////////////////////////////////////////////////////////
+
+bool TraceEncodeCapture(const uint8_t shift, uint8_t* block, const size_t blockSize, const TraceWriter_t write, void* ctx){
+
+    assert(blockSize >= TRACE_HEADER_SIZE + TRACE_TOKEN_MAX);
+
+    const struct DCP_Capture_t* const capture = CaptureGet();
+    const uint32_t freqMHz = esp_clk_cpu_freq()/1e6;
+    struct DCP_TraceCodec_t codec;
+
+    TraceCodecInit(&codec, TargetTiming()->delta*freqMHz, freqMHz, shift);
+
+    size_t used = TraceEncodeHeader(&codec, capture->edges, block);
+
+    for (uint32_t i = 0; i < capture->edges; ++i){
+        if (used + TRACE_TOKEN_MAX > blockSize){
+            if (!write(block, used, ctx)) return false;
+            used = 0;
+        }
+
+        used += TraceEncodeEdge(&codec, CaptureEdge(i), &block[used]);
+    }
+
+    return write(block, used, ctx);
+}
+
+static bool s_WriteFile(const uint8_t* data, const size_t size, void* ctx){
+    return fwrite(data, 1, size, (FILE*)ctx) == size;
+}
+
+bool TraceStore(const char* path, const uint8_t shift){
+
+    uint8_t block[256];
+
+    FILE* file = fopen(path, "wb");
+    if (!file){
+        ESP_LOGE(TAG, "could not open %s", path);
+        return false;
+    }
+
+    const bool ok = TraceEncodeCapture(shift, block, sizeof block, s_WriteFile, file);
+
+    fclose(file);
+
+    if (!ok){
+        ESP_LOGE(TAG, "could not write %s", path);
+        remove(path);
+    }
+
+    return ok;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_cpu.h"
+
+///////////////////////////////////////////////////////////////
+
+/*
+ * compressed trace format, little endian
+ *
+ * header: "DCPT", version, shift, 2 reserved bytes, delta in cycles (u32),
+ *         CPU MHz (u32), edges (u32)
+ * then one varint per edge interval, in 2^shift cycles:
+ *     tag = value & 0x7
+ *     tag < TRACE_SYMBOLS: zigzag(interval - predicted interval of the symbol) = value >> 3
+ *     tag == TRACE_RAW: interval = value >> 3
+ *
+ * DCP intervals are almost always 1, 2, 7.5, 25 or 50 delta, each symbol
+ * predicts from the running average of its intervals, (3*p + i + 2)/4, so
+ * the residual is only the jitter
+ */
+
+#define TRACE_MAGIC         "DCPT"
+#define TRACE_VERSION       1
+#define TRACE_HEADER_SIZE   20
+#define TRACE_SYMBOLS       5
+#define TRACE_RAW           7
+//biggest varint of an interval
+#define TRACE_TOKEN_MAX     6
+
+struct DCP_TraceCodec_t {
+    uint8_t shift;
+    uint32_t deltaCycles;
+    uint32_t freqMHz;
+    uint32_t expected[TRACE_SYMBOLS];   //nominal intervals, in 2^shift cycles
+    uint32_t predicted[TRACE_SYMBOLS];  //running interval of each symbol
+    esp_cpu_cycle_count_t last;         //last edge, encoder only
+    bool started;
+};
+
+/*!
+ * @brief prepares the codec for a trace
+ * @param deltaCycles = transmission time unit, in cycles
+ * @param shift = intervals are kept in 2^shift cycles, 0 is lossless
+ */
+void TraceCodecInit(struct DCP_TraceCodec_t* codec, const uint32_t deltaCycles, const uint32_t freqMHz, const uint8_t shift);
+
+size_t TraceEncodeHeader(const struct DCP_TraceCodec_t* codec, const uint32_t edges, uint8_t out[TRACE_HEADER_SIZE]);
+//encodes the interval to the edge at t, the first edge only sets the origin. Returns bytes written
+size_t TraceEncodeEdge(struct DCP_TraceCodec_t* codec, const esp_cpu_cycle_count_t t, uint8_t out[TRACE_TOKEN_MAX]);
+
+//reads the header and inits the codec from it, returns the edges or -1 if invalid
+int32_t TraceDecodeHeader(struct DCP_TraceCodec_t* codec, const uint8_t in[TRACE_HEADER_SIZE]);
+//decodes one interval, in cycles. Returns bytes read or 0 if the token is invalid
+size_t TraceDecodeInterval(struct DCP_TraceCodec_t* codec, const uint8_t* in, const size_t size, uint32_t* interval);
+
+///////////////////////////////////////////////////////////////
+
+//sink of the encoded trace, returns false to abort
+typedef bool (*TraceWriter_t)(const uint8_t* data, const size_t size, void* ctx);
+
+/*!
+ * @brief encodes the window of the last capture, in blocks of up to blockSize bytes
+ * @return false if the writer aborted
+ */
+bool TraceEncodeCapture(const uint8_t shift, uint8_t* block, const size_t blockSize, const TraceWriter_t write, void* ctx);
+
+//stores the window of the last capture in a file
+bool TraceStore(const char* path, const uint8_t shift);
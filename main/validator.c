@@ -1,5 +1,8 @@
 #include "DCP.h"
 #include "validator.h"
+#include "rules.h"
+#include "adcprobe.h"
+#include "capture.h"
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -15,12 +18,26 @@
 
 extern portMUX_TYPE criticalMutex;
 
-struct DCP_electrical_t MeasureElectrical(const gpio_num_t pin){
-    struct DCP_electrical_t ret = {0};
+//VIH and VIL from the probe, true if it also timed the edges
+static bool s_FromProbe(const struct DCP_ADCProbe_t* probe, struct DCP_electrical_t* ret){
+    ret->VIH = probe->VIH;
+    ret->VIL = probe->VIL;
+
+    if (!probe->rising || !probe->falling) return false;
+
+    ret->rise = probe->rise;
+    ret->falling = probe->fall;
 
-    //TODO use oneshot ADC
-    ret.VIH = 3.3;
-    ret.VIL = 0;
+    return true;
+}
+
+//the shortest plateau is one delta, with the speed still unknown it may be the fastest one
+static float s_ShortestPlateau(void){
+    return DCPSpeedTiming(TargetAutoSpeed()? ULTRA: TargetSpeed())->delta;
+}
+
+//no edges seen or timed, time one edge driven by the validator instead
+static void s_DrivenEdges(const gpio_num_t pin, struct DCP_electrical_t* ret){
 
     gpio_set_direction(pin, GPIO_MODE_INPUT);
     gpio_set_level(pin, 0);
@@ -41,31 +58,42 @@ struct DCP_electrical_t MeasureElectrical(const gpio_num_t pin){
 
     ESP_LOGV("Electrical", "th: %lu\ttl: %lu", th, tl);
 
-    ret.rise = (double)th/esp_clk_cpu_freq();
-    ret.falling = (double)tl/esp_clk_cpu_freq();
-    ESP_LOGV("Electrical", "rise: %f\tfalling: %f", ret.rise, ret.falling);
+    ret->rise = (double)th/esp_clk_cpu_freq();
+    ret->falling = (double)tl/esp_clk_cpu_freq();
+    ESP_LOGV("Electrical", "rise: %f\tfalling: %f", ret->rise, ret->falling);
+}
 
-    ret.cycle = ret.rise + ret.falling;
+static void s_Cycle(struct DCP_electrical_t* ret){
+    ret->cycle = ret->rise + ret->falling;
 
-    if (ret.cycle != 0){
-        ret.speed = 1/ret.cycle;
+    if (ret->cycle != 0){
+        ret->speed = 1/ret->cycle;
     }
+}
+
+struct DCP_electrical_t MeasureElectrical(const gpio_num_t pin){
+    struct DCP_electrical_t ret = {0};
+
+    //the levels and edges of the DUT traffic, if there was any
+    struct DCP_ADCProbe_t probe;
+    if (!ADCProbe(pin, CONFIG_DCP_ADC_WINDOW_MS, s_ShortestPlateau(), &probe) || !s_FromProbe(&probe, &ret)){
+        s_DrivenEdges(pin, &ret);
+    }
+
+    s_Cycle(&ret);
 
     return ret;
 }
 
 ///////////////////////////////////////////////////////////////
 
-extern volatile struct {
-    float delta;    //transmission time unit
-    float moe;      //transmission margin of error
-    esp_cpu_cycle_count_t limits[2];
-} configParam;
+//timing of the bus under test, copied from its handle
+static struct DCP_Timing_t configParam;
 
 static DCP_MODE targetParams;
 
 extern bool s_SendBytes(gpio_num_t const pin, uint8_t const size, uint8_t const data[size], unsigned const delays[restrict 3]);
-extern uint8_t s_ReadByte(const gpio_num_t pin);
+extern uint8_t s_ReadByte(const gpio_num_t pin, const esp_cpu_cycle_count_t limit);
 
 ///////////////////////////////////////////////////////////////
 
@@ -109,8 +137,113 @@ uint8_t ReadByte(const gpio_num_t pin){
     return byte;
 }
 
-uint32_t ValidL3(uint8_t* data){return 0;}
-uint32_t ValidGeneric(uint8_t* data){return 0;}
+void SetTargetAddress(const uint8_t addr){
+    targetParams.addr = addr;
+}
+
+uint8_t TargetAddress(void){
+    return targetParams.addr;
+}
+
+void SetTargetController(const bool isController){
+    targetParams.isController = isController;
+}
+
+uint8_t TargetSyncDeltas(void){
+    return targetParams.isController? 25: 50;
+}
+
+//as the bus or the detected speed gave it, the tolerance is applied on top of it
+static struct DCP_Timing_t busParam;
+static float tolerance;
+static bool autoSpeed;
+
+static void s_ApplyTolerance(void){
+
+    configParam = busParam;
+    if (tolerance <= 0) return;
+
+    const float mhz = esp_clk_cpu_freq()/1e6;
+
+    configParam.moe = tolerance*configParam.delta;
+    configParam.limits[0] = (configParam.delta - configParam.moe)*mhz;
+    configParam.limits[1] = (configParam.delta + configParam.moe)*mhz;
+}
+
+void SetTargetBus(const DCP_Handle* bus){
+    busParam = *DCPTiming(bus);
+    s_ApplyTolerance();
+}
+
+void SetTargetTolerance(const float margin){
+    tolerance = margin;
+    s_ApplyTolerance();
+}
+
+void SetTargetSpeed(const enum DCP_Speed_e speed){
+    busParam = *DCPSpeedTiming(speed);
+    s_ApplyTolerance();
+}
+
+void SetTargetAutoSpeed(const bool enable){
+    autoSpeed = enable;
+}
+
+bool TargetAutoSpeed(void){
+    return autoSpeed;
+}
+
+enum DCP_Speed_e TargetSpeed(void){
+    for (enum DCP_Speed_e speed = SLOW; speed <= ULTRA; ++speed){
+        if (busParam.delta == DCPSpeedTiming(speed)->delta) return speed;
+    }
+
+    return SLOW;
+}
+
+bool DetectSpeed(const esp_cpu_cycle_count_t sync, const esp_cpu_cycle_count_t bitSyncHigh, enum DCP_Speed_e* speed){
+
+    //the classes are at least 1.6 times apart, a wide window still picks
+    //one and a DUT a few percent off is detected and then reported
+    for (enum DCP_Speed_e s = SLOW; s <= ULTRA; ++s){
+        const struct DCP_Timing_t* const timing = DCPSpeedTiming(s);
+        const float delta = (timing->limits[0] + timing->limits[1])/2.f;
+
+        if (bitSyncHigh < 7.5*.85*delta || bitSyncHigh > 7.5*1.15*delta) continue;
+
+        //the bits are 1 or 2 delta, only a sync is this long
+        if (sync < 20*delta) continue;
+
+        *speed = s;
+        return true;
+    }
+
+    return false;
+}
+
+const struct DCP_Timing_t* TargetTiming(void){
+    return &configParam;
+}
+
+uint32_t ValidL3(uint8_t* data){
+
+    const esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+    const uint32_t errors = RulesEvaluate(RULES_L3, data, sizeof(struct DCP_Message_L3_t)+1, targetParams.addr);
+
+    ESP_LOGV("Rules", "L3 frame checked in %lu cycles", esp_cpu_get_cycle_count() - start);
+
+    return errors;
+}
+
+uint32_t ValidGeneric(uint8_t* data){
+
+    const esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+    const uint32_t errors = RulesEvaluate(RULES_generic, data, data[0], targetParams.addr);
+
+    ESP_LOGV("Rules", "generic frame checked in %lu cycles", esp_cpu_get_cycle_count() - start);
+
+    return errors;
+}
 
 struct DCP_Transmission_t TestConnection(const gpio_num_t pin){
 
@@ -146,11 +279,10 @@ struct DCP_Transmission_t TestConnection(const gpio_num_t pin){
 
             esp_cpu_set_cycle_count(0);
 
-            //TODO change the hardcoded 25 to target param
             //check sync limit
-            if(rawCycles.sync > 25*configParam.limits[1]){
+            if(rawCycles.sync > TargetSyncDeltas()*configParam.limits[1]){
                ret.errors |= ERROR_sync_tooLong;
-            }else if(rawCycles.sync < 25*configParam.limits[0]){
+            }else if(rawCycles.sync < TargetSyncDeltas()*configParam.limits[0]){
                ret.errors |= ERROR_sync_tooShort;
             }
 
@@ -203,25 +335,25 @@ struct DCP_Transmission_t TestConnection(const gpio_num_t pin){
 
 ///////////////////////////////////////////////////////////////
 
-struct DCP_timings_t GetTimes(const gpio_num_t pin){
+static struct DCP_timings_t s_Times(const struct rawCycles_t raw){
 
     struct DCP_timings_t ret;
     const uint32_t freqMHz = esp_clk_cpu_freq()/1e6; //should be 180
 
     ESP_LOGV("times", "sync: %lu\t BSH: %lu\t BSL: %lu\tB0: %lu\tB1: %lu", 
-        rawCycles.sync,
-        rawCycles.bitSync_high,
-        rawCycles.bitSync_low,
-        rawCycles.bit0,
-        rawCycles.bit1
+        raw.sync,
+        raw.bitSync_high,
+        raw.bitSync_low,
+        raw.bit0,
+        raw.bit1
     );
 
     ret.speed = 0xFF;
-    ret.sync = (double)rawCycles.sync/freqMHz;
-    ret.bitSync_low = (double)rawCycles.bitSync_low/freqMHz;
-    ret.bitSync_high = (double)rawCycles.bitSync_high/freqMHz;
-    ret.bit0 = (double)rawCycles.bit0/freqMHz;
-    ret.bit1 = (double)rawCycles.bit1/freqMHz;
+    ret.sync = (double)raw.sync/freqMHz;
+    ret.bitSync_low = (double)raw.bitSync_low/freqMHz;
+    ret.bitSync_high = (double)raw.bitSync_high/freqMHz;
+    ret.bit0 = (double)raw.bit0/freqMHz;
+    ret.bit1 = (double)raw.bit1/freqMHz;
 
     if(ret.bit0 < 2){
         ret.speed = 64;
@@ -236,6 +368,84 @@ struct DCP_timings_t GetTimes(const gpio_num_t pin){
     return ret;
 }
 
+struct DCP_timings_t GetTimes(const gpio_num_t pin){
+    return s_Times(rawCycles);
+}
+
+///////////////////////////////////////////////////////////////
+
+struct ValidationState_t {
+    uint32_t wanted;
+    bool adc;                           //the probe runs alongside the capture
+    struct DCP_Validation_t* ret;
+    uint64_t sums[5];                   //sync, bitsync high and low, bit0, bit1
+    uint32_t counts[5];
+};
+
+static bool s_OnValidationFrame(const struct DCP_Frame_t* frame, const uint32_t seq, void* ctx){
+    struct ValidationState_t* const state = ctx;
+    struct DCP_Validation_t* const ret = state->ret;
+
+    if (ret->frames++ == 0){
+        ret->transmission.type = frame->size? frame->data[0]: 0;
+    }
+    ret->transmission.errors |= frame->errors;
+
+    //a field the frame did not get to is not a time
+    const esp_cpu_cycle_count_t times[5] = {frame->sync, frame->bitSync_high, frame->bitSync_low, frame->bit0, frame->bit1};
+    for (int i = 0; i < 5; ++i){
+        if (times[i] == 0) continue;
+
+        state->sums[i] += times[i];
+        state->counts[i]++;
+    }
+
+    //the ADC buffer is emptied between frames, the bus poller owns the core otherwise
+    const bool adcDone = !state->adc || ADCProbeDrain(0);
+
+    return ret->frames >= state->wanted && adcDone;
+}
+
+bool ValidateTraffic(const gpio_num_t pin, const uint32_t frames, const uint32_t timeoutMs, const bool adc, struct DCP_Validation_t* ret){
+
+    *ret = (struct DCP_Validation_t){0};
+
+    struct ValidationState_t state = {
+        .wanted = frames? frames: 1,
+        .ret = ret
+    };
+
+    state.adc = adc && ADCProbeStart(pin, CONFIG_DCP_ADC_WINDOW_MS, s_ShortestPlateau());
+
+    (void)CaptureListen(pin, timeoutMs, s_OnValidationFrame, &state);
+
+    struct DCP_ADCProbe_t probe = {0};
+    if (state.adc) ADCProbeStop(&probe);
+
+    if (ret->frames == 0){
+        ret->transmission.errors = ERROR_noTransmission;
+        return false;
+    }
+
+    struct rawCycles_t raw = {0};
+    esp_cpu_cycle_count_t* const fields[5] = {&raw.sync, &raw.bitSync_high, &raw.bitSync_low, &raw.bit0, &raw.bit1};
+    for (int i = 0; i < 5; ++i){
+        if (state.counts[i]) *fields[i] = state.sums[i]/state.counts[i];
+    }
+
+    ret->timings = s_Times(raw);
+
+    //the capture left the bus quiet, driving one edge can't hurt a frame
+    if (!s_FromProbe(&probe, &ret->electrical)){
+        s_DrivenEdges(pin, &ret->electrical);
+    }
+    s_Cycle(&ret->electrical);
+
+    ESP_LOGI("Validation", "%lu frames, errors 0x%lX, %lu ADC samples", ret->frames, (uint32_t)ret->transmission.errors, probe.samples);
+
+    return true;
+}
+
 ///////////////////////////////////////////////////////////////
 
 static const struct DCP_Message_t yieldMessage = (struct DCP_Message_t){
@@ -246,13 +456,16 @@ static const struct DCP_Message_t yieldMessage = (struct DCP_Message_t){
     }
 };
 
-enum Collision_e DoesYield(const gpio_num_t pin){
+enum Collision_e DoesYield(const gpio_num_t pin, const uint32_t timeoutMs){
     enum Collision_e collisionFlag = COL_null;
     const uint32_t freqMHz = esp_clk_cpu_freq()/1e6;
 
     gpio_set_direction(pin, GPIO_MODE_INPUT);
 
-    for(esp_cpu_set_cycle_count(0); esp_cpu_get_cycle_count() < 10UL*esp_clk_cpu_freq();){
+    //the cycle counter is reset for every frame, the window is kept in ticks
+    const TickType_t begin = xTaskGetTickCount();
+
+    while(xTaskGetTickCount() - begin < pdMS_TO_TICKS(timeoutMs)){
         if(gpio_get_level(pin) == 0){
             //wait for SYNC to end
             while(gpio_get_level(pin) == 0) continue;
@@ -267,10 +480,10 @@ enum Collision_e DoesYield(const gpio_num_t pin){
                     return collisionFlag;
             }
 
-            (void)s_ReadByte(pin);
+            (void)s_ReadByte(pin, configParam.limits[1]);
 
             //let's read one byte and interrupt the transmission
-            (void)s_ReadByte(pin);
+            (void)s_ReadByte(pin, configParam.limits[1]);
 
             DCP_Data_t message = {.message = &yieldMessage};
             bool collision = s_SendBytes(pin, message.message->type, message.data,
@@ -279,7 +492,8 @@ enum Collision_e DoesYield(const gpio_num_t pin){
             gpio_set_direction(pin, GPIO_MODE_INPUT);
             //assert(collisionFlag == COL_null);
 
-            collisionFlag = collision? COL_true: COL_false;
+            //one interrupted frame answers it
+            return collision? COL_true: COL_false;
         }
     }
 
@@ -5,6 +5,8 @@
 
 #include <driver/gpio.h>
 
+#include "DCP.h"
+
 enum DCP_Errors_e {
     ERROR_none = 0UL,
     ERROR_sync_inf = 1UL,
@@ -49,13 +51,54 @@ struct DCP_electrical_t {
     float speed;
 };
 
+struct DCP_Validation_t {
+    struct DCP_electrical_t electrical;
+    struct DCP_Transmission_t transmission;     //type of the first frame, errors of all of them
+    struct DCP_timings_t timings;               //mean of the frames
+    uint32_t frames;
+};
+
 ///////////////////////////////////////////////////////////////
 
 struct DCP_Transmission_t TestConnection(const gpio_num_t pin);
 struct DCP_timings_t GetTimes(const gpio_num_t pin);
 struct DCP_electrical_t MeasureElectrical(const gpio_num_t pin);
 
+/*!
+ * @brief electrical, timing and framing checks from one capture of the DUT traffic
+ * @param frames = frames to decode before stopping
+ * @param adc = sample the line with the ADC alongside the edges
+ * @return false if no frame was seen before timeoutMs
+ *
+ * replaces MeasureElectrical, TestConnection and GetTimes, which each wait
+ * for their own transmission. The yield test still needs its own
+ */
+bool ValidateTraffic(const gpio_num_t pin, const uint32_t frames, const uint32_t timeoutMs, const bool adc, struct DCP_Validation_t* ret);
+
+//expected source ID of the DUT L3 frames, 0 skips the check
+void SetTargetAddress(const uint8_t addr);
+uint8_t TargetAddress(void);
+//a controller DUT sends a 25 delta sync, any other node a 50 delta one
+void SetTargetController(const bool isController);
+uint8_t TargetSyncDeltas(void);
+
+//the DUT bus, its timing is used by every test until the next call
+void SetTargetBus(const DCP_Handle* bus);
+const struct DCP_Timing_t* TargetTiming(void);
+//margin of error of the timing checks as a fraction of delta, 0 restores the one of the bus
+void SetTargetTolerance(const float margin);
+
+//the precomputed limits of a speed class replace the ones of the bus
+void SetTargetSpeed(const enum DCP_Speed_e speed);
+//the captures find the speed of the DUT from its first bit sync, see CaptureListen
+void SetTargetAutoSpeed(const bool enable);
+bool TargetAutoSpeed(void);
+//speed class of the target timing, the last detected one in auto mode
+enum DCP_Speed_e TargetSpeed(void);
+//speed class whose bit sync matches, false if the pulses are not a sync and a bit sync
+bool DetectSpeed(const esp_cpu_cycle_count_t sync, const esp_cpu_cycle_count_t bitSyncHigh, enum DCP_Speed_e* speed);
+
 uint32_t ValidL3(uint8_t* data);
 uint32_t ValidGeneric(uint8_t* data);
 
-enum Collision_e DoesYield(const gpio_num_t pin);
+enum Collision_e DoesYield(const gpio_num_t pin, const uint32_t timeoutMs);
@@ -0,0 +1,574 @@
+/*
+ * DCP bus simulator
+ *
+ * host side discrete event model of N nodes on a wired-AND bus, each one
+ * running the busHandler state machine of main/DCP.c with its timings:
+ *
+ *  - LISTENING: gives up if the bus is low, else delays (addr + 6) * delta/4
+ *    inside a critical section, then STARTING gives up if the bus is low
+ *  - STARTING: sync low (25 delta as controller, 50 otherwise), bit sync
+ *    8 delta high and 8 delta low
+ *  - SENDING (s_SendBytes): per bit releases the bus for 1 or 2 delta, a low
+ *    bus at its end is a collision, then holds it low for 2 delta and a low
+ *    bus after releasing it is a collision. On collision it goes straight
+ *    back to LISTENING with the same message
+ *  - WAITING: blocks one RTOS tick on the ISR ring buffer before taking the
+ *    next message from the TX queue
+ *  - the retry policy of DCPSetRetryPolicy: a message is dropped after
+ *    --max-retries collisions, its priority delay gains a random back-off of
+ *    up to 2^min(retries, --window) - 1 deltas and loses delta/4 every
+ *    --aging collisions. The defaults (0) are the behaviour without a policy
+ *
+ * a falling edge made by someone else fires the bus ISR on every node outside
+ * a critical section, which keeps its task blocked until the frame ends.
+ * Interrupts are masked during the priority delay, as the code is written, so
+ * ulTaskNotifyTake can't see the bus being taken; --notify-in-delay models
+ * the intended behaviour instead.
+ *
+ * time is counted in delta/4, the resolution of the priority delay
+ *
+ * build: cc -O2 -o bussim tools/bussim.c -lm
+ * usage: bussim [--nodes N] [--rate msgs/s/node] [--speed 0-3] [--time s]
+ *               [--tick-ms ms] [--seed n] [--notify-in-delay] [--sweep]
+ *               [--max-retries n] [--window n] [--aging n]
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QUARTERS(delta) ((uint64_t)(4*(delta)))
+#define NEVER UINT64_MAX
+#define QUEUE_SIZE 8 //TXmessageQueue depth
+#define FRAME_SIZE 13 //L3 frame, type byte included
+#define MAX_NODES 254
+
+static const double deltaLUT[] = {20, 4, 2.5, 1.25};
+
+enum State_e {
+    IDLE,       //nothing to send
+    WAITING,    //blocked on the ring buffer for an RTOS tick
+    DELAYING,   //priority delay of LISTENING
+    SYNC,
+    BITSYNC_HIGH,
+    BITSYNC_LOW,
+    BIT_HIGH,
+    BIT_LOW
+};
+
+struct Node_t {
+    uint8_t addr;
+    bool isController;
+    enum State_e state;
+    uint64_t wake;          //end of the current state
+    bool low;               //pulling the bus low
+
+    bool rx;                //bus ISR running, the task is blocked
+    bool due;               //task timer expired while blocked
+    bool edge;              //falling edge seen while interrupts were masked
+
+    //TX queue, enqueue times
+    uint64_t queue[QUEUE_SIZE];
+    int queued;
+    uint8_t frame[FRAME_SIZE];
+    int bit;
+    unsigned retries;       //collisions of the message being sent
+
+    uint64_t nextArrival;
+
+    //stats
+    uint64_t offered;
+    uint64_t attempts;
+    uint64_t collisions;
+    uint64_t sent;
+    uint64_t dropped;       //TX queue full
+    uint64_t gaveUp;        //too many collisions
+    uint64_t* latencies;
+    size_t latencyCount;
+    size_t latencyCap;
+};
+
+struct Config_t {
+    int nodes;
+    double rate;            //messages per second per node
+    int speed;
+    double time;            //simulated seconds
+    double tickMs;          //RTOS tick
+    unsigned seed;
+    bool notifyInDelay;
+
+    //retry policy
+    unsigned maxRetries;
+    unsigned window;
+    unsigned aging;
+};
+
+static struct Node_t nodes[MAX_NODES];
+static double quarterUs;
+static uint64_t now;
+
+///////////////////////////////////////////////////////////////
+
+static double s_Uniform(void){
+    return (rand() + 1.0) / (RAND_MAX + 2.0);
+}
+
+static uint64_t s_NextArrival(const struct Config_t* config){
+    if (config->rate <= 0) return NEVER;
+    return now + (uint64_t)(-log(s_Uniform()) / config->rate * 1e6 / quarterUs) + 1;
+}
+
+static void s_BuildFrame(struct Node_t* node){
+    node->frame[0] = 0;
+    node->frame[1] = 0x01;
+    node->frame[2] = node->addr;
+
+    for (int i = 3; i < FRAME_SIZE; ++i){
+        node->frame[i] = rand();
+    }
+    node->frame[11] = 0;
+
+    node->bit = 0;
+    node->retries = 0;
+}
+
+static int s_Bit(const struct Node_t* node){
+    return (node->frame[node->bit >> 3] >> (7 - (node->bit & 0x7))) & 0x1;
+}
+
+static bool s_BusLow(const int count){
+    for (int i = 0; i < count; ++i){
+        if (nodes[i].low) return true;
+    }
+    return false;
+}
+
+static bool s_Transmitting(const struct Node_t* node){
+    return node->state >= SYNC;
+}
+
+static bool s_Masked(const struct Node_t* node){
+    return node->state >= DELAYING;
+}
+
+static void s_Latency(struct Node_t* node, const uint64_t latency){
+    if (node->latencyCount == node->latencyCap){
+        node->latencyCap = node->latencyCap? 2*node->latencyCap: 256;
+        node->latencies = realloc(node->latencies, node->latencyCap * sizeof(uint64_t));
+    }
+    node->latencies[node->latencyCount++] = latency;
+}
+
+static int s_Compare(const void* a, const void* b){
+    const uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y? -1: x > y;
+}
+
+///////////////////////////////////////////////////////////////
+
+static void s_Wait(struct Node_t* node, const struct Config_t* config){
+    node->state = WAITING;
+    node->wake = now + (uint64_t)(config->tickMs * 1e3 / quarterUs);
+}
+
+//LISTENING, the message is already taken from the queue
+static void s_Listen(struct Node_t* node, const struct Config_t* config, const bool busLow){
+    if (busLow){
+        s_Wait(node, config);
+        return;
+    }
+
+    unsigned slots = node->addr + 6;
+
+    if (config->aging){
+        const unsigned boost = node->retries / config->aging;
+        slots -= boost < node->addr? boost: node->addr;
+    }
+
+    if (config->window && node->retries){
+        const unsigned exp = node->retries < config->window? node->retries: config->window;
+        slots += 4 * (rand() & ((1U << exp) - 1));
+    }
+
+    node->state = DELAYING;
+    node->edge = false;
+    node->wake = now + slots;
+}
+
+//the message at the head of the queue is done with, sent or not
+static void s_Next(struct Node_t* node, const struct Config_t* config, const bool busLow){
+    memmove(node->queue, node->queue + 1, --node->queued * sizeof(uint64_t));
+
+    if (node->queued){
+        s_BuildFrame(node);
+        s_Listen(node, config, busLow);
+    }else {
+        node->state = IDLE;
+        node->wake = NEVER;
+    }
+}
+
+static void s_Collision(struct Node_t* node, const struct Config_t* config, const bool busLow){
+    node->collisions++;
+    node->bit = 0;
+
+    node->retries++;
+
+    if (config->maxRetries && node->retries >= config->maxRetries){
+        node->gaveUp++;
+        s_Next(node, config, busLow);
+        return;
+    }
+
+    s_Listen(node, config, busLow);
+}
+
+//the task is blocked by the ISR, its timer fires when the frame ends
+static void s_Block(struct Node_t* node){
+    node->due = true;
+    node->wake = NEVER;
+}
+
+static void s_Step(const struct Config_t* config){
+
+    const uint64_t deltaQ = 4;
+    const int count = config->nodes;
+    const bool wasLow = s_BusLow(count);
+
+    //releases first, everyone samples the bus, then the new pulls
+    bool pull[MAX_NODES] = {0};
+
+    for (int i = 0; i < count; ++i){
+        struct Node_t* const node = &nodes[i];
+        if (node->wake != now) continue;
+
+        if (node->state == SYNC || node->state == BITSYNC_LOW || node->state == BIT_LOW){
+            node->low = false;
+        }
+    }
+
+    const bool busLow = s_BusLow(count);
+
+    for (int i = 0; i < count; ++i){
+        struct Node_t* const node = &nodes[i];
+        if (node->wake != now) continue;
+
+        switch(node->state){
+            case WAITING:
+                if (node->rx){
+                    s_Block(node);
+                    break;
+                }
+                s_Listen(node, config, busLow);
+                break;
+            case DELAYING:
+                if ((config->notifyInDelay && node->edge) || busLow){
+                    //someone took the bus, back to waiting with the message in hand
+                    s_Wait(node, config);
+                    break;
+                }
+
+                node->attempts++;
+                node->state = SYNC;
+                node->wake = now + QUARTERS(node->isController? 25: 50);
+                pull[i] = true;
+                break;
+            case SYNC:
+                node->state = BITSYNC_HIGH;
+                node->wake = now + QUARTERS(8);
+                break;
+            case BITSYNC_HIGH:
+                node->state = BITSYNC_LOW;
+                node->wake = now + QUARTERS(8);
+                pull[i] = true;
+                break;
+            case BITSYNC_LOW:
+                node->state = BIT_HIGH;
+                node->wake = now + (s_Bit(node)? 2: 1) * deltaQ;
+                break;
+            case BIT_HIGH:
+                if (busLow){
+                    s_Collision(node, config, busLow);
+                    break;
+                }
+                node->state = BIT_LOW;
+                node->wake = now + 2*deltaQ;
+                pull[i] = true;
+                break;
+            case BIT_LOW:
+                if (busLow){
+                    s_Collision(node, config, busLow);
+                    break;
+                }
+
+                if (++node->bit < 8*FRAME_SIZE){
+                    node->state = BIT_HIGH;
+                    node->wake = now + (s_Bit(node)? 2: 1) * deltaQ;
+                    break;
+                }
+
+                //sent, the next message is taken right away
+                node->sent++;
+                s_Latency(node, now - node->queue[0]);
+                s_Next(node, config, busLow);
+                break;
+            default:
+                node->wake = NEVER;
+                break;
+        }
+    }
+
+    for (int i = 0; i < count; ++i){
+        if (pull[i]) nodes[i].low = true;
+    }
+
+    //falling edge, the bus ISR fires on everyone not masking it
+    if (!wasLow && s_BusLow(count)){
+        for (int i = 0; i < count; ++i){
+            struct Node_t* const node = &nodes[i];
+
+            if (s_Transmitting(node) && node->low) continue;
+
+            if (s_Masked(node)){
+                node->edge = true;
+            }else {
+                node->rx = true;
+            }
+        }
+    }
+
+    //frame over, blocked tasks resume
+    bool transmitting = false;
+    for (int i = 0; i < count; ++i){
+        transmitting |= s_Transmitting(&nodes[i]);
+    }
+
+    if (!transmitting){
+        for (int i = 0; i < count; ++i){
+            struct Node_t* const node = &nodes[i];
+
+            //an edge seen while masked fires the ISR once unmasked, the frame is already over
+            node->rx = false;
+
+            if (node->due){
+                node->due = false;
+                node->wake = now + 1;
+            }
+        }
+    }
+}
+
+static void s_Arrivals(const struct Config_t* config){
+    for (int i = 0; i < config->nodes; ++i){
+        struct Node_t* const node = &nodes[i];
+
+        while (node->nextArrival == now){
+            node->nextArrival = s_NextArrival(config);
+            node->offered++;
+
+            if (node->queued == QUEUE_SIZE){
+                node->dropped++;
+                continue;
+            }
+
+            node->queue[node->queued++] = now;
+
+            if (node->state == IDLE){
+                //xQueueReceive returns as soon as the message arrives
+                s_BuildFrame(node);
+                node->state = WAITING;
+                node->wake = now;
+
+                if (node->rx) s_Block(node);
+            }
+        }
+    }
+}
+
+//a latency column, "-" when there is no frame to take it from
+static void s_PrintUs(const size_t samples, const double us){
+    if (samples) printf(" %10.0f", us);
+    else printf(" %10s", "-");
+}
+
+///////////////////////////////////////////////////////////////
+
+struct Result_t {
+    double throughput;      //frames per second
+    double utilisation;     //share of the bus time carrying sent frames
+    double collisionRate;   //collisions per attempt
+    double p50;             //latency percentiles of all nodes, us
+    double p99;
+    size_t samples;         //latencies behind them, none if no frame was sent
+    int starved;            //nodes that sent less than half of their messages
+};
+
+static struct Result_t s_Run(const struct Config_t* config, const bool verbose){
+
+    srand(config->seed);
+    quarterUs = deltaLUT[config->speed] / 4;
+    now = 0;
+
+    for (int i = 0; i < config->nodes; ++i){
+        free(nodes[i].latencies);
+        nodes[i] = (struct Node_t){
+            .addr = i + 1,
+            .isController = i == 0,
+            .state = IDLE,
+            .wake = NEVER
+        };
+        nodes[i].nextArrival = s_NextArrival(config);
+    }
+
+    const uint64_t end = config->time * 1e6 / quarterUs;
+
+    while (now < end){
+        uint64_t next = NEVER;
+        for (int i = 0; i < config->nodes; ++i){
+            if (nodes[i].wake < next) next = nodes[i].wake;
+            if (nodes[i].nextArrival < next) next = nodes[i].nextArrival;
+        }
+
+        if (next == NEVER || next >= end) break;
+        now = next;
+
+        s_Arrivals(config);
+        s_Step(config);
+    }
+
+    struct Result_t result = {0};
+    uint64_t sent = 0, attempts = 0, collisions = 0;
+    size_t total = 0;
+
+    for (int i = 0; i < config->nodes; ++i){
+        sent += nodes[i].sent;
+        attempts += nodes[i].attempts;
+        collisions += nodes[i].collisions;
+        total += nodes[i].latencyCount;
+
+        if (2*nodes[i].sent < nodes[i].offered){
+            result.starved++;
+        }
+    }
+
+    uint64_t* all = malloc((total + 1) * sizeof(uint64_t));
+    size_t n = 0;
+
+    if (verbose){
+        printf("addr      sent  attempts  collisions  dropped  gave up     p50 us     p99 us     max us\n");
+    }
+
+    for (int i = 0; i < config->nodes; ++i){
+        struct Node_t* const node = &nodes[i];
+
+        memcpy(all + n, node->latencies, node->latencyCount * sizeof(uint64_t));
+        n += node->latencyCount;
+
+        if (!verbose) continue;
+
+        qsort(node->latencies, node->latencyCount, sizeof(uint64_t), s_Compare);
+        const size_t c = node->latencyCount;
+
+        printf("%4u %9" PRIu64 " %9" PRIu64 " %11" PRIu64 " %8" PRIu64 " %8" PRIu64,
+               node->addr, node->sent, node->attempts, node->collisions, node->dropped, node->gaveUp);
+        s_PrintUs(c, c? node->latencies[c/2] * quarterUs: 0);
+        s_PrintUs(c, c? node->latencies[c*99/100] * quarterUs: 0);
+        s_PrintUs(c, c? node->latencies[c-1] * quarterUs: 0);
+        printf("\n");
+    }
+
+    qsort(all, n, sizeof(uint64_t), s_Compare);
+
+    //frame time without arbitration: sync, bit sync and the bits, 1.5 + 2 delta on average
+    const double frameUs = (25 + 16 + 8*FRAME_SIZE*3.5) * deltaLUT[config->speed];
+
+    result.throughput = sent / config->time;
+    result.utilisation = result.throughput * frameUs / 1e6;
+    result.collisionRate = attempts? (double)collisions / attempts: 0;
+    result.p50 = n? all[n/2] * quarterUs: 0;
+    result.p99 = n? all[n*99/100] * quarterUs: 0;
+    result.samples = n;
+
+    free(all);
+
+    return result;
+}
+
+static void s_Print(const struct Config_t* config, const struct Result_t* result){
+    printf("%5d %9.1f %10.1f %8.1f%% %10.3f",
+           config->nodes, config->rate, result->throughput, 100*result->utilisation,
+           result->collisionRate);
+    s_PrintUs(result->samples, result->p50);
+    s_PrintUs(result->samples, result->p99);
+    printf(" %7d\n", result->starved);
+}
+
+int main(int argc, char** argv){
+
+    struct Config_t config = {
+        .nodes = 8,
+        .rate = 10,
+        .speed = 0,
+        .time = 10,
+        .tickMs = 10,
+        .seed = 1,
+        .notifyInDelay = false
+    };
+    bool sweep = false;
+
+    for (int i = 1; i < argc; ++i){
+        const char* const arg = argv[i];
+        const char* const value = i + 1 < argc? argv[i + 1]: "0";
+
+        if (strcmp(arg, "--nodes") == 0){ config.nodes = atoi(value); ++i; }
+        else if (strcmp(arg, "--rate") == 0){ config.rate = atof(value); ++i; }
+        else if (strcmp(arg, "--speed") == 0){ config.speed = atoi(value); ++i; }
+        else if (strcmp(arg, "--time") == 0){ config.time = atof(value); ++i; }
+        else if (strcmp(arg, "--tick-ms") == 0){ config.tickMs = atof(value); ++i; }
+        else if (strcmp(arg, "--seed") == 0){ config.seed = atoi(value); ++i; }
+        else if (strcmp(arg, "--notify-in-delay") == 0){ config.notifyInDelay = true; }
+        else if (strcmp(arg, "--sweep") == 0){ sweep = true; }
+        else if (strcmp(arg, "--max-retries") == 0){ config.maxRetries = atoi(value); ++i; }
+        else if (strcmp(arg, "--window") == 0){ config.window = atoi(value); ++i; }
+        else if (strcmp(arg, "--aging") == 0){ config.aging = atoi(value); ++i; }
+        else {
+            fprintf(stderr, "usage: %s [--nodes N] [--rate msgs/s/node] [--speed 0-3] [--time s] "
+                            "[--tick-ms ms] [--seed n] [--notify-in-delay] [--sweep] "
+                            "[--max-retries n] [--window n] [--aging n]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (config.nodes < 1 || config.nodes > MAX_NODES || config.speed < 0 || config.speed > 3){
+        fprintf(stderr, "nodes must be 1~%d and speed 0~3\n", MAX_NODES);
+        return 1;
+    }
+
+    printf("nodes  rate/node  frames/s     busy  col/tries     p50 us     p99 us starved\n");
+
+    if (!sweep){
+        const struct Result_t result = s_Run(&config, true);
+        s_Print(&config, &result);
+        return 0;
+    }
+
+    //load grows with the node count and the per node rate
+    const int counts[] = {2, 4, 8, 16, 32, 64};
+    const double rates[] = {1, 5, 10, 20, 50};
+
+    for (size_t i = 0; i < sizeof counts / sizeof counts[0]; ++i){
+        for (size_t j = 0; j < sizeof rates / sizeof rates[0]; ++j){
+            config.nodes = counts[i];
+            config.rate = rates[j];
+
+            const struct Result_t result = s_Run(&config, false);
+            s_Print(&config, &result);
+        }
+    }
+
+    return 0;
+}
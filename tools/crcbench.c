@@ -0,0 +1,235 @@
+/*
+ * DCP CRC-8 and frame rules benchmark
+ *
+ * host side comparison of the L3 CRC-8 variants of main/DCP_spec.c, the
+ * 256 entry table (default) and the 16 entry nibble table
+ * (CONFIG_DCP_CRC8_NIBBLE), against the bitwise polynomial division:
+ *
+ *  - the check value of "123456789" must be 0xF4 for all of them
+ *  - they must agree on --inputs random buffers of 0 to 64 bytes
+ *  - then each one is timed over the 11 bytes the L3 CRC covers and over
+ *    a 64 byte buffer
+ *
+ * the cost of a whole frame check is also timed, RulesEvaluate of
+ * main/rules.c over a valid L3 frame, one with a bad CRC and a generic
+ * frame, with the built in rules only. On the device ValidL3 and
+ * ValidGeneric log the cycles of each check at the verbose level of the
+ * "Rules" tag, these are the host figures.
+ *
+ * DCP_spec.c is included twice, the second time with the nibble table
+ * and its symbols renamed, so both variants are the code the device
+ * builds
+ *
+ * exits with 1 if a variant disagrees or a frame gets the wrong errors
+ *
+ * build: cc -O2 -Itools/host -Imain -o crcbench tools/crcbench.c main/rules.c
+ * usage: crcbench [--inputs n] [--rounds n] [--seed n]
+ */
+
+#include "DCP_spec.c"
+
+#define CONFIG_DCP_CRC8_NIBBLE
+#define deltaLUT deltaLUTNibble
+#define crcLUT crcLUTNibble
+#define DCPCRC8 DCPCRC8Nibble
+#define DCPStampL3 DCPStampL3Nibble
+#define DCPSpeedTiming DCPSpeedTimingNibble
+#include "DCP_spec.c"
+#undef CONFIG_DCP_CRC8_NIBBLE
+#undef deltaLUT
+#undef crcLUT
+#undef DCPCRC8
+#undef DCPStampL3
+#undef DCPSpeedTiming
+
+#include "rules.h"
+#include "validator.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_INPUT 64
+#define L3_COVERED offsetof(struct DCP_Message_L3_t, CRC)
+#define FRAME_SIZE (sizeof(struct DCP_Message_L3_t) + 1) //type byte included
+
+typedef uint8_t (*CRC_f)(const uint8_t* data, const size_t size);
+
+static uint32_t state;
+static volatile uint32_t sink; //keeps the timed calls from being optimised out
+
+///////////////////////////////////////////////////////////////
+
+static uint32_t s_Random(void){
+    //xorshift32, the same sequence for a seed on every host
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+//MSB first division by x^8 + x^2 + x + 1, no init and no final xor
+static uint8_t s_CRCBitwise(const uint8_t* data, const size_t size){
+
+    uint8_t crc = 0;
+
+    for (size_t i = 0; i < size; ++i){
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit)
+            crc = crc & 0x80? (crc << 1) ^ 0x07: crc << 1;
+    }
+
+    return crc;
+}
+
+static double s_Now(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec*1e-9;
+}
+
+//ns per call of the CRC over size bytes
+static double s_TimeCRC(const CRC_f crc, const uint8_t* data, const size_t size, const uint32_t rounds){
+
+    uint32_t acc = 0;
+    const double start = s_Now();
+
+    for (uint32_t i = 0; i < rounds; ++i)
+        acc += crc(data, size - (i & 1)); //varies the size so the call isn't hoisted
+
+    const double elapsed = s_Now() - start;
+    sink = acc;
+
+    return elapsed*1e9/rounds;
+}
+
+//ns per RulesEvaluate of the frame
+static double s_TimeRules(const enum RuleSet_e set, const uint8_t* data, const size_t size, const uint8_t target, const uint32_t rounds, uint32_t* errors){
+
+    uint32_t acc = 0;
+    const double start = s_Now();
+
+    for (uint32_t i = 0; i < rounds; ++i)
+        acc |= RulesEvaluate(set, data, size, target);
+
+    const double elapsed = s_Now() - start;
+    sink = acc;
+    *errors = acc;
+
+    return elapsed*1e9/rounds;
+}
+
+///////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv){
+
+    uint32_t inputs = 100000;
+    uint32_t rounds = 10000000;
+    uint32_t seed = 1;
+
+    for (int i = 1; i < argc; ++i){
+        const char* const arg = argv[i];
+        const char* const value = i + 1 < argc? argv[i + 1]: "0";
+
+        if (strcmp(arg, "--inputs") == 0){ inputs = strtoul(value, NULL, 0); ++i; }
+        else if (strcmp(arg, "--rounds") == 0){ rounds = strtoul(value, NULL, 0); ++i; }
+        else if (strcmp(arg, "--seed") == 0){ seed = strtoul(value, NULL, 0); ++i; }
+        else {
+            fprintf(stderr, "usage: %s [--inputs n] [--rounds n] [--seed n]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    state = seed? seed: 1;
+    rounds = rounds? rounds: 1;
+
+    static const struct {
+        const char* name;
+        CRC_f crc;
+    } variants[] = {
+        {"table 256", DCPCRC8},
+        {"nibble 16", DCPCRC8Nibble},
+        {"bitwise", s_CRCBitwise}
+    };
+    const size_t count = sizeof variants / sizeof variants[0];
+
+    bool ok = true;
+
+    //check value of the CRC-8/SMBUS catalogue entry, the same polynomial
+    const uint8_t check[] = "123456789";
+
+    for (size_t v = 0; v < count; ++v){
+        const uint8_t crc = variants[v].crc(check, sizeof check - 1);
+        printf("%-10s check 0x%02X %s\n", variants[v].name, crc, crc == 0xF4? "ok": "WRONG");
+        ok &= crc == 0xF4;
+    }
+
+    uint32_t mismatches = 0;
+    uint8_t buffer[MAX_INPUT];
+
+    for (uint32_t i = 0; i < inputs; ++i){
+        const size_t size = s_Random() % (MAX_INPUT + 1);
+
+        for (size_t b = 0; b < size; ++b)
+            buffer[b] = s_Random();
+
+        const uint8_t reference = s_CRCBitwise(buffer, size);
+
+        if (DCPCRC8(buffer, size) != reference || DCPCRC8Nibble(buffer, size) != reference)
+            ++mismatches;
+    }
+
+    printf("%" PRIu32 " random inputs, %" PRIu32 " mismatches\n\n", inputs, mismatches);
+    ok &= mismatches == 0;
+
+    printf("%-10s %10s %10s\n", "", "L3 ns", "64 B ns");
+
+    for (size_t b = 0; b < MAX_INPUT; ++b)
+        buffer[b] = s_Random();
+
+    for (size_t v = 0; v < count; ++v){
+        printf("%-10s %10.2f %10.2f\n", variants[v].name,
+                s_TimeCRC(variants[v].crc, buffer, L3_COVERED, rounds),
+                s_TimeCRC(variants[v].crc, buffer, MAX_INPUT, rounds));
+    }
+
+    //frames as the decoder hands them to ValidL3 and ValidGeneric
+    const uint8_t target = 0x2A;
+    uint8_t L3[FRAME_SIZE] = {0};
+    struct DCP_Message_L3_t* const message = (struct DCP_Message_L3_t*)&L3[1];
+
+    message->IDS = target;
+    message->IDD = 0x01;
+    message->COD = 0x10;
+    for (size_t b = 0; b < sizeof message->data; ++b)
+        message->data[b] = s_Random();
+    message->PAD = DCP_L3_PAD;
+    DCPStampL3(message);
+
+    uint8_t badCRC[FRAME_SIZE];
+    memcpy(badCRC, L3, sizeof badCRC);
+    ((struct DCP_Message_L3_t*)&badCRC[1])->CRC ^= 0x01;
+
+    const uint8_t generic[] = {4, target, 0x55, 0xAA};
+
+    printf("\n%-10s %10s %10s\n", "rules", "frame ns", "errors");
+
+    uint32_t errors;
+    double ns;
+
+    ns = s_TimeRules(RULES_L3, L3, sizeof L3, target, rounds, &errors);
+    printf("%-10s %10.2f %#10" PRIx32 "\n", "L3", ns, errors);
+    ok &= errors == ERROR_none;
+
+    ns = s_TimeRules(RULES_L3, badCRC, sizeof badCRC, target, rounds, &errors);
+    printf("%-10s %10.2f %#10" PRIx32 "\n", "L3 bad CRC", ns, errors);
+    ok &= errors == ERROR_message_invalidL3_CRC;
+
+    ns = s_TimeRules(RULES_generic, generic, generic[0], target, rounds, &errors);
+    printf("%-10s %10.2f %#10" PRIx32 "\n", "generic", ns, errors);
+    ok &= errors == ERROR_none;
+
+    return ok? 0: 1;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+//the 160MHz clock of the ESP32-C3, from the host monotonic clock
+static inline esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (esp_cpu_cycle_count_t)(t.tv_sec*160000000ULL + t.tv_nsec*16/100);
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+static inline int esp_clk_cpu_freq(void){ return 160000000; }
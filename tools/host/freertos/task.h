@@ -0,0 +1,8 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef void* TaskHandle_t;
+
+static inline void vTaskDelay(const TickType_t ticks){ (void)ticks; }
+static inline TickType_t xTaskGetTickCount(void){ return 0; }
@@ -0,0 +1,6 @@
+#pragma once
+
+//defaults of main/Kconfig.projbuild
+#define CONFIG_DCP_PROFILE_RULES 16
+#define CONFIG_DCP_CAPTURE_EDGES 4096
+#define CONFIG_DCP_CAPTURE_FRAMES 16
@@ -0,0 +1,118 @@
+/*
+ * DCP validator self test on the host
+ *
+ * runs DUTSelfTest of main/dutmodel.c without a board: every fault
+ * combination of the software DUT, at every speed, goes through the frame
+ * decoder of main/capture.c and the rules of main/rules.c, and the errors
+ * they report are compared to the ones the faults must raise. The device
+ * headers come from tools/host, which stands in for the few IDF calls the
+ * decoder makes. The target state validator.c keeps on the device is kept
+ * here, with the same checks.
+ *
+ * exits with 1 if any case failed, so it can gate a change to the decoder
+ *
+ * build: cc -O2 -Itools/host -Imain -o selftest tools/selftest.c main/capture.c
+ *        main/rules.c main/dutmodel.c main/DCP_spec.c -lm
+ * usage: selftest [--seed n] [--seeds n]
+ */
+
+#include "capture.h"
+#include "dutmodel.h"
+#include "rules.h"
+#include "validator.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+///////////////////////////////////////////////////////////////
+
+//what the decoder and the rules read from validator.c
+static uint8_t targetAddress;
+static struct DCP_Timing_t targetTiming;
+
+void SetTargetAddress(const uint8_t addr){
+    targetAddress = addr;
+}
+
+uint8_t TargetAddress(void){
+    return targetAddress;
+}
+
+//the software DUT is a controller
+uint8_t TargetSyncDeltas(void){
+    return 25;
+}
+
+void SetTargetSpeed(const enum DCP_Speed_e speed){
+    targetTiming = *DCPSpeedTiming(speed);
+}
+
+const struct DCP_Timing_t* TargetTiming(void){
+    return &targetTiming;
+}
+
+bool TargetAutoSpeed(void){
+    return false;
+}
+
+bool DetectSpeed(const esp_cpu_cycle_count_t sync, const esp_cpu_cycle_count_t bitSyncHigh, enum DCP_Speed_e* speed){
+    return false;
+}
+
+uint32_t ValidL3(uint8_t* data){
+    return RulesEvaluate(RULES_L3, data, sizeof(struct DCP_Message_L3_t)+1, targetAddress);
+}
+
+uint32_t ValidGeneric(uint8_t* data){
+    return RulesEvaluate(RULES_generic, data, data[0], targetAddress);
+}
+
+///////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv){
+
+    uint32_t seed = 1;
+    uint32_t seeds = 1;
+
+    for (int i = 1; i < argc; ++i){
+        const char* const arg = argv[i];
+        const char* const value = i + 1 < argc? argv[i + 1]: "0";
+
+        if (strcmp(arg, "--seed") == 0){ seed = strtoul(value, NULL, 0); ++i; }
+        else if (strcmp(arg, "--seeds") == 0){ seeds = strtoul(value, NULL, 0); ++i; }
+        else {
+            fprintf(stderr, "usage: %s [--seed n] [--seeds n]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    uint32_t failed = 0;
+
+    printf("      seed    cases   failed   cases/s\n");
+
+    for (uint32_t s = seed; s < seed + seeds; ++s){
+        struct DCP_SelfTest_t report;
+        struct timespec begin, end;
+
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        DUTSelfTest(s, &report);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        const double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec)*1e-9;
+
+        printf("%10" PRIu32 " %8" PRIu32 " %8" PRIu32 " %9.0f\n", s, report.cases, report.failed,
+                seconds > 0? report.cases/seconds: 0);
+
+        if (report.failed){
+            printf("  first failure: faults 0x%" PRIx32 " at speed %d, expected 0x%" PRIx32 ", reported 0x%" PRIx32 "\n",
+                    report.faults, report.speed, report.expected, report.reported);
+        }
+
+        failed += report.failed;
+    }
+
+    return failed? 1: 0;
+}